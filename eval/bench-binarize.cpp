@@ -0,0 +1,82 @@
+// Compares the fused invert+threshold kernel used by findSegments against
+// the original `cleanup(Scalar::all(255) - img, 10)` path.
+//
+// Usage: bench-binarize [image...]
+// With no arguments a synthetic 3000x4000 page is used.
+
+#include <cstring>
+#include <iostream>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "../src/segments.hpp"
+#include "../src/util.hpp"
+
+using namespace cv;
+using namespace std;
+
+static const int ITERATIONS = 20;
+static const unsigned char THRESH = 10;
+
+// the original implementation, kept here as the reference
+static Mat cleanup(Mat m, unsigned char thresh) {
+    for (int row = 0; row < m.rows; ++row) {
+        for (int col = 0; col < m.cols; ++col) {
+            unsigned char& val = m.at<unsigned char>(row, col);
+            val = val < thresh ? 0 : 0xff;
+        }
+    }
+    return m;
+}
+
+static bool identical(const Mat& a, const Mat& b) {
+    if (a.size() != b.size() || a.type() != b.type()) {
+        return false;
+    }
+    for (int row = 0; row < a.rows; ++row) {
+        if (memcmp(a.ptr(row), b.ptr(row), a.cols) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bench(const char* name, const Mat& img) {
+    Mat reference;
+    auto start = Clock::now();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        reference = cleanup(Scalar::all(255) - img, THRESH);
+    }
+    double referenceMs = millisSince(start) / ITERATIONS;
+
+    Mat fused;
+    start = Clock::now();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        binarizeInverted(img, THRESH, fused);
+    }
+    double fusedMs = millisSince(start) / ITERATIONS;
+
+    cout << name << " (" << img.cols << 'x' << img.rows << "): "
+         << "reference " << referenceMs << " ms, "
+         << "fused " << fusedMs << " ms, "
+         << "speedup " << referenceMs / fusedMs << "x, "
+         << (identical(reference, fused) ? "identical" : "MISMATCH") << endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        Mat img(4000, 3000, CV_8UC1);
+        randu(img, Scalar::all(0), Scalar::all(256));
+        bench("synthetic", img);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        Mat img = imread(argv[i], CV_LOAD_IMAGE_GRAYSCALE);
+        if (img.empty()) {
+            cerr << "failed to read image '" << argv[i] << '\'' << endl;
+            return 1;
+        }
+        bench(argv[i], img);
+    }
+    return 0;
+}
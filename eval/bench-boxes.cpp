@@ -0,0 +1,76 @@
+// Times explain on synthetic sketches of 1 to 200 hand-drawn boxes laid out
+// on a grid, and checks that it finds them all, both over the whole sketch
+// and split into regions (--explain-regions).
+//
+// Usage: bench-boxes [max-boxes]
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "../src/explanation.hpp"
+#include "../src/geometry.hpp"
+#include "../src/voting.hpp"
+#include "../src/util.hpp"
+
+using namespace cv;
+using namespace std;
+
+static const int CELL = 300;
+
+static int jitter() {
+    return rand() % 7 - 3;
+}
+
+static void addStroke(vector<Stroke>& strokes, Vec4i line) {
+    strokes.push_back(Stroke { line, angleOf(line) });
+}
+
+static vector<Stroke> sketch(int boxes) {
+    int columns = (int)ceil(sqrt(boxes));
+    vector<Stroke> strokes;
+    for (int i = 0; i < boxes; ++i) {
+        int x = (i % columns) * CELL + 20 + rand() % 40;
+        int y = (i / columns) * CELL + 20 + rand() % 40;
+        int w = 100 + rand() % 120, h = 100 + rand() % 120;
+        addStroke(strokes, Vec4i(x + jitter(),     y + jitter(),     x + w + jitter(), y + jitter()));
+        addStroke(strokes, Vec4i(x + jitter(),     y + h + jitter(), x + w + jitter(), y + h + jitter()));
+        addStroke(strokes, Vec4i(x + jitter(),     y + jitter(),     x + jitter(),     y + h + jitter()));
+        addStroke(strokes, Vec4i(x + w + jitter(), y + jitter(),     x + w + jitter(), y + h + jitter()));
+    }
+    return strokes;
+}
+
+int main(int argc, char** argv) {
+    int maxBoxes = argc > 1 ? atoi(argv[1]) : 200;
+    const int counts[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+    srand(1);
+    for (int boxes : counts) {
+        if (boxes > maxBoxes) {
+            break;
+        }
+        auto votes = placeVotes(sketch(boxes), vector<TextBox>());
+        auto start = Clock::now();
+        auto objects = explain(votes);
+        double ms = millisSince(start);
+
+        ExplainOptions byRegion;
+        byRegion.splitRegions = true;
+        start = Clock::now();
+        auto regionObjects = explain(votes, byRegion);
+        double regionMs = millisSince(start);
+
+        int found = 0, regionFound = 0;
+        for (auto o : objects) {
+            found += o->type == LAYOUT_BOX;
+        }
+        for (auto o : regionObjects) {
+            regionFound += o->type == LAYOUT_BOX;
+        }
+        cout << boxes << " boxes: " << ms << " ms, found " << found
+             << "; by region: " << regionMs << " ms, found " << regionFound << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Times formConstraints on generated layouts of nested boxes, with only the
+// nearest containers and with full containment (--full-containment), counts
+// the constraints each one emits, and times toLayout on each.
+//
+// Usage: bench-constraints [max-boxes]
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../src/constraints.hpp"
+#include "../src/explanation.hpp"
+#include "../src/layout.hpp"
+#include "../src/util.hpp"
+
+using namespace std;
+
+static LayoutObject* box(int x, int y, int w, int h) {
+    LayoutObject* o = new LayoutObject;
+    o->type = LAYOUT_BOX;
+    o->data.boxData[0] = x;
+    o->data.boxData[1] = y;
+    o->data.boxData[2] = w;
+    o->data.boxData[3] = h;
+    return o;
+}
+
+// Splits a box into a grid of 1 to 3 by 1 to 3 padded children, breadth
+// first, until there are `count` boxes.
+static vector<LayoutObject*> layout(int count) {
+    vector<LayoutObject*> objects { box(0, 0, 100000, 100000) };
+    for (size_t next = 0; (int)objects.size() < count; ++next) {
+        auto& parent = objects[next]->data.boxData;
+        int columns = 1 + rand() % 3, rows = 1 + rand() % 3;
+        int w = parent[2] / columns, h = parent[3] / rows;
+        for (int i = 0; i < columns * rows && (int)objects.size() < count; ++i) {
+            int x = parent[0] + (i % columns) * w, y = parent[1] + (i / columns) * h;
+            objects.push_back(box(x + w / 10, y + h / 10, w * 8 / 10, h * 8 / 10));
+        }
+    }
+    return objects;
+}
+
+int main(int argc, char** argv) {
+    int maxBoxes = argc > 1 ? atoi(argv[1]) : 800;
+    srand(1);
+    for (int boxes = 25; boxes <= maxBoxes; boxes *= 2) {
+        auto objects = layout(boxes);
+
+        auto start = Clock::now();
+        auto nearest = formConstraints(objects);
+        double nearestMs = millisSince(start);
+
+        ConstraintOptions fullOptions;
+        fullOptions.fullContainment = true;
+        start = Clock::now();
+        auto full = formConstraints(objects, fullOptions);
+        double fullMs = millisSince(start);
+
+        start = Clock::now();
+        toLayout(objects, nearest);
+        double nearestLayoutMs = millisSince(start);
+        start = Clock::now();
+        toLayout(objects, full);
+        double fullLayoutMs = millisSince(start);
+
+        cout << boxes << " boxes: nearest " << nearestMs << " ms, " << nearest.size() << " constraints, layout " << nearestLayoutMs << " ms; "
+             << "full " << fullMs << " ms, " << full.size() << " constraints, layout " << fullLayoutMs << " ms" << endl;
+
+        for (auto o : objects) {
+            delete o;
+        }
+    }
+    return 0;
+}
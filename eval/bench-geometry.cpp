@@ -0,0 +1,108 @@
+// Measures the batch geometry kernels against the scalar functions in
+// geometry.hpp, in segment pairs per second, and checks that both agree.
+//
+// Usage: bench-geometry [segment-count]
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../src/geometry.hpp"
+#include "../src/batchgeometry.hpp"
+#include "../src/util.hpp"
+
+using namespace cv;
+using namespace std;
+
+static const int QUERIES = 200;
+
+static vector<Vec4i> randomSegments(int n) {
+    vector<Vec4i> segments;
+    for (int i = 0; i < n; ++i) {
+        int x = rand() % 4000;
+        int y = rand() % 3000;
+        segments.push_back(Vec4i(x, y, x + rand() % 400 - 200, y + rand() % 400 - 200));
+    }
+    return segments;
+}
+
+static void report(const char* what, double scalarMs, double batchMs, double pairs, double maxError) {
+    cout << what << ": "
+         << "scalar " << pairs / scalarMs / 1000 << " M/s, "
+         << "batch " << pairs / batchMs / 1000 << " M/s, "
+         << "speedup " << scalarMs / batchMs << "x, "
+         << "max relative error " << maxError
+         << (maxError <= BATCH_EPSILON ? "" : " (EXCEEDS BATCH_EPSILON)") << endl;
+}
+
+int main(int argc, char** argv) {
+    const int n = argc > 1 ? atoi(argv[1]) : 100000;
+    srand(0);
+    const vector<Vec4i> segments = randomSegments(n);
+    const vector<Vec4i> queries = randomSegments(QUERIES);
+    const SegmentArray soa(segments);
+    vector<double> scalar(n), batch(n);
+
+    // segment to segment
+    double scalarMs = 0, batchMs = 0, maxError = 0;
+    for (auto& q : queries) {
+        auto start = Clock::now();
+        for (int i = 0; i < n; ++i) {
+            scalar[i] = closestApproach(q, segments[i]);
+        }
+        scalarMs += millisSince(start);
+
+        start = Clock::now();
+        batchClosestApproach(q, soa, batch.data());
+        batchMs += millisSince(start);
+
+        for (int i = 0; i < n; ++i) {
+            maxError = max(maxError, abs(scalar[i] - batch[i]) / max(1.0, scalar[i]));
+        }
+    }
+    report("segment-segment", scalarMs, batchMs, (double)n * QUERIES, maxError);
+
+    // point to segment
+    scalarMs = batchMs = maxError = 0;
+    for (auto& q : queries) {
+        Vec2i pt = p1(q);
+        auto start = Clock::now();
+        for (int i = 0; i < n; ++i) {
+            scalar[i] = closestApproach(pt, segments[i]);
+        }
+        scalarMs += millisSince(start);
+
+        start = Clock::now();
+        batchClosestApproach(pt, soa, batch.data());
+        batchMs += millisSince(start);
+
+        for (int i = 0; i < n; ++i) {
+            maxError = max(maxError, abs(scalar[i] - batch[i]) / max(1.0, scalar[i]));
+        }
+    }
+    report("point-segment", scalarMs, batchMs, (double)n * QUERIES, maxError);
+
+    // angles and orientation
+    vector<unsigned char> scalarHorizontal(n), batchHorizontal(n);
+    auto start = Clock::now();
+    for (int i = 0; i < n; ++i) {
+        scalar[i] = angleOf(segments[i]);
+        scalarHorizontal[i] = mostlyHorizontal(segments[i]);
+    }
+    scalarMs = millisSince(start);
+
+    start = Clock::now();
+    batchAngleOf(soa, batch.data());
+    batchMostlyHorizontal(soa, batchHorizontal.data());
+    batchMs = millisSince(start);
+
+    maxError = 0;
+    for (int i = 0; i < n; ++i) {
+        maxError = max(maxError, abs(scalar[i] - batch[i]));
+    }
+    report("angle+orientation", scalarMs, batchMs, n, maxError);
+    if (scalarHorizontal != batchHorizontal) {
+        cout << "orientation MISMATCH" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Compares the label recognizer with Tesseract on the measurement labels
+// Tesseract finds in each image: how often the recognizer is sure of
+// itself, how often it then agrees with Tesseract, and how long each takes
+// per label. Then, for a range of LabelThresholds, how many labels it reads
+// the same and how many other words it wrongly reads as labels.
+//
+// Usage: bench-labels image...
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "../src/labels.hpp"
+#include "../src/ocr.hpp"
+#include "../src/util.hpp"
+
+using namespace cv;
+using namespace std;
+
+// how much page around each label both recognizers get to see
+static const int LABEL_MARGIN = 5;
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " image..." << endl;
+        return 1;
+    }
+
+    struct Word {
+        Mat crop;
+        Point origin;
+        string text;
+        bool label;
+    };
+    vector<Word> words;
+
+    int labels = 0, sure = 0, agreed = 0, tesseractRead = 0;
+    double labelMs = 0, tesseractMs = 0;
+    for (int i = 1; i < argc; ++i) {
+        Mat img = imread(argv[i], CV_LOAD_IMAGE_GRAYSCALE);
+        if (img.empty()) {
+            cerr << "failed to read image '" << argv[i] << '\'' << endl;
+            return 1;
+        }
+
+        const Rect page(0, 0, img.size().width, img.size().height);
+        for (auto& box : findText(img)) {
+            string expected(box.text, strcspn(box.text, " \n"));
+            const Rect& b = box.boundary;
+            Rect crop = Rect(b.x - LABEL_MARGIN, b.y - LABEL_MARGIN, b.width + 2*LABEL_MARGIN, b.height + 2*LABEL_MARGIN) & page;
+            bool isLabel = looksLikeLabel(expected.c_str());
+            if (!expected.empty()) {
+                words.push_back(Word { img(crop), crop.tl(), expected, isLabel });
+            }
+            if (!isLabel) {
+                continue;
+            }
+            ++labels;
+
+            auto start = Clock::now();
+            TextBox label;
+            bool ok = recognizeLabel(img(crop), crop.tl(), label);
+            labelMs += millisSince(start);
+            if (ok) {
+                ++sure;
+                agreed += expected == label.text;
+                cout << argv[i] << ": '" << expected << "' read as '" << label.text << "' (" << label.confidence << ")" << endl;
+                delete[] label.text;
+            } else {
+                cout << argv[i] << ": '" << expected << "' unsure" << endl;
+            }
+
+            // Tesseract on the same crop, as findText would see it alone
+            start = Clock::now();
+            auto words = findText(img(crop));
+            tesseractMs += millisSince(start);
+            for (auto& w : words) {
+                tesseractRead += expected == string(w.text, strcspn(w.text, " \n"));
+                delete[] w.text;
+            }
+        }
+    }
+
+    if (labels == 0) {
+        cout << "no labels found" << endl;
+        return 0;
+    }
+    cout << labels << " labels" << endl;
+    cout << "  recognizer: sure of " << sure << ", agreed with Tesseract on " << agreed << ", "
+         << labelMs / labels << " ms per label" << endl;
+    cout << "  tesseract on the crop alone: read " << tesseractRead << " the same, "
+         << tesseractMs / labels << " ms per label" << endl;
+
+    // A wrong label costs more than an unsure one, which only costs a
+    // Tesseract call, so the best setting reads the most labels the same
+    // while wrongly accepting next to no other words.
+    cout << "min score, min margin: labels read the same / wrong / unsure, other words read as labels" << endl;
+    for (float minScore : { 0.5f, 0.6f, 0.7f, 0.8f }) {
+        for (float minMargin : { 0.04f, 0.08f, 0.12f, 0.16f }) {
+            LabelThresholds thresholds;
+            thresholds.minScore = minScore;
+            thresholds.minMargin = minMargin;
+            int same = 0, wrong = 0, unsure = 0, falseLabels = 0, others = 0;
+            for (auto& w : words) {
+                TextBox label;
+                bool ok = recognizeLabel(w.crop, w.origin, label, thresholds);
+                if (w.label) {
+                    same += ok && w.text == label.text;
+                    wrong += ok && w.text != label.text;
+                    unsure += !ok;
+                } else {
+                    ++others;
+                    falseLabels += ok;
+                }
+                if (ok) {
+                    delete[] label.text;
+                }
+            }
+            cout << "  " << minScore << ", " << minMargin << ": "
+                 << same << " / " << wrong << " / " << unsure << " of " << labels << ", "
+                 << falseLabels << " of " << others << endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Times findText in its different modes, and findTextNearStrokes, and compares
+// the text boxes each one finds against the original per-word recognition.
+// First checks that upscaled crops find text drawn inside a box.
+//
+// Usage: bench-ocr image...
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../src/ocr.hpp"
+#include "../src/parallel.hpp"
+#include "../src/segments.hpp"
+#include "../src/strokes.hpp"
+#include "../src/util.hpp"
+
+using namespace cv;
+using namespace std;
+
+static bool sameBox(const TextBox& a, const TextBox& b) {
+    Rect overlap = a.boundary & b.boundary;
+    return overlap.area() * 2 > max(a.boundary.area(), b.boundary.area());
+}
+
+static bool sameText(const TextBox& a, const TextBox& b) {
+    // per-word recognition leaves line breaks on the end of its words
+    size_t la = strcspn(a.text, "\n");
+    size_t lb = strcspn(b.text, "\n");
+    return la == lb && strncmp(a.text, b.text, la) == 0;
+}
+
+static void report(const string& mode, double ms, double baselineMs,
+        const vector<TextBox>& boxes, const vector<TextBox>& reference) {
+    int located = 0, read = 0;
+    for (auto& r : reference) {
+        for (auto& b : boxes) {
+            if (sameBox(r, b)) {
+                ++located;
+                read += sameText(r, b);
+                break;
+            }
+        }
+    }
+    cout << "  " << mode << ": " << ms << " ms (" << baselineMs / ms << "x), "
+         << boxes.size() << " boxes, "
+         << located << '/' << reference.size() << " reference boxes located, "
+         << read << " with the same text" << endl;
+}
+
+static double timeOcr(const Mat& img, const OcrOptions& options, vector<TextBox>& boxes) {
+    auto start = Clock::now();
+    boxes = findText(img, options);
+    return millisSince(start);
+}
+
+// Draws a button, a caption inside a box, and checks that reading only
+// the crops around glyphs still finds the caption.
+static void boxedText() {
+    Mat img(300, 600, CV_8UC1, Scalar(255));
+    rectangle(img, Point(50, 50), Point(550, 250), Scalar(0), 3);
+    putText(img, "Submit", Point(200, 170), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(0), 3);
+    const Rect inside(50, 50, 500, 200);
+
+    OcrOptions options;
+    options.upscaling = UPSCALE_TEXT_CROPS;
+    bool found = false;
+    for (auto& w : findText(img, options)) {
+        found = found || ((w.boundary & inside) == w.boundary && strncmp(w.text, "Submit", 6) == 0);
+        delete[] w.text;
+    }
+    cout << "text inside a box: " << (found ? "found" : "MISSED") << " with upscaled crops" << endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " image..." << endl;
+        return 1;
+    }
+
+    // pay for engine initialization up front so it doesn't skew the first image
+    {
+        OcrLease warmup(OcrEnginePool::shared());
+    }
+
+    boxedText();
+
+    for (int i = 1; i < argc; ++i) {
+        Mat img = imread(argv[i], CV_LOAD_IMAGE_GRAYSCALE);
+        if (img.empty()) {
+            cerr << "failed to read image '" << argv[i] << '\'' << endl;
+            return 1;
+        }
+        cout << argv[i] << endl;
+
+        OcrOptions options;
+        vector<TextBox> reference, boxes;
+        options.mode = OCR_PER_WORD;
+        double baselineMs = timeOcr(img, options, reference);
+        report("per-word", baselineMs, baselineMs, reference, reference);
+
+        options.mode = OCR_SINGLE_PASS;
+        double ms = timeOcr(img, options, boxes);
+        report("single-pass", ms, baselineMs, boxes, reference);
+
+        for (int threads = 2; threads <= defaultThreadCount(); threads *= 2) {
+            options.threads = threads;
+            ms = timeOcr(img, options, boxes);
+            report("single-pass x" + to_string(threads), ms, baselineMs, boxes, reference);
+        }
+
+        options.threads = 1;
+        options.upscaling = UPSCALE_TEXT_CROPS;
+        ms = timeOcr(img, options, boxes);
+        report("upscaled crops", ms, baselineMs, boxes, reference);
+        options.upscaling = UPSCALE_PAGE;
+
+        // the share of the page it looks at is logged by findTextNearStrokes
+        auto strokes = findStrokes(findSegments(img));
+        auto start = Clock::now();
+        boxes = findTextNearStrokes(img, strokes, options);
+        report("near strokes", millisSince(start), baselineMs, boxes, reference);
+    }
+    return 0;
+}
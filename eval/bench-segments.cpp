@@ -0,0 +1,110 @@
+// Times the segment engines on the given images and checks that the strokes
+// built from their output agree with the single-pass Hough transform.
+//
+// Usage: bench-segments [--scale=N] image...
+// --scale upsamples every input by N first, to mimic high-resolution scans;
+// e.g. `bench-segments --scale=4 examples/*.png` for 12+ MP phone photos.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../src/segments.hpp"
+#include "../src/strokes.hpp"
+#include "../src/geometry.hpp"
+#include "../src/parallel.hpp"
+#include "../src/util.hpp"
+
+using namespace cv;
+using namespace std;
+
+static const int ITERATIONS = 3;
+
+// endpoints within this distance count as the same stroke
+static const double STROKE_TOLERANCE = 10.0;
+
+static bool sameStroke(const Vec4i& a, const Vec4i& b, double tolerance) {
+    return (distance(p1(a), p1(b)) < tolerance && distance(p2(a), p2(b)) < tolerance) ||
+           (distance(p1(a), p2(b)) < tolerance && distance(p2(a), p1(b)) < tolerance);
+}
+
+// fraction of reference strokes that have a counterpart in `strokes`
+static double strokeRecall(const vector<Stroke>& reference, const vector<Stroke>& strokes, double tolerance) {
+    if (reference.empty()) {
+        return 1.0;
+    }
+    int matched = 0;
+    for (auto& r : reference) {
+        for (auto& s : strokes) {
+            if (sameStroke(r.line, s.line, tolerance)) {
+                ++matched;
+                break;
+            }
+        }
+    }
+    return (double)matched / reference.size();
+}
+
+static void report(const char* engine, int threads, double ms, double baselineMs,
+        const vector<Vec4i>& segments, const vector<Stroke>& strokes, const vector<Stroke>& reference, double tolerance) {
+    cout << "  " << engine << " x" << threads << ": "
+         << ms << " ms (" << baselineMs / ms << "x), "
+         << segments.size() << " segments, "
+         << strokes.size() << " strokes, "
+         << strokeRecall(reference, strokes, tolerance) * 100 << "% of reference strokes found, "
+         << strokeRecall(strokes, reference, tolerance) * 100 << "% of strokes in reference" << endl;
+}
+
+static double timeEngine(const Mat& img, SegmentEngine engine, int threads, vector<Vec4i>& segments) {
+    segments = findSegments(img, engine, threads); // warm up
+    auto start = Clock::now();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        segments = findSegments(img, engine, threads);
+    }
+    return millisSince(start) / ITERATIONS;
+}
+
+int main(int argc, char** argv) {
+    double scale = 1.0;
+    int first = 1;
+    if (argc > 1 && strncmp(argv[1], "--scale=", 8) == 0) {
+        scale = atof(argv[1] + 8);
+        first = 2;
+    }
+    if (first >= argc || scale <= 0) {
+        cerr << "Usage: " << argv[0] << " [--scale=N] image..." << endl;
+        return 1;
+    }
+
+    for (int i = first; i < argc; ++i) {
+        Mat img = imread(argv[i], CV_LOAD_IMAGE_GRAYSCALE);
+        if (img.empty()) {
+            cerr << "failed to read image '" << argv[i] << '\'' << endl;
+            return 1;
+        }
+        if (scale != 1.0) {
+            resize(img, img, Size(0, 0), scale, scale, INTER_CUBIC);
+        }
+        const double tolerance = STROKE_TOLERANCE * scale;
+        cout << argv[i] << " (" << img.cols << 'x' << img.rows << ")" << endl;
+
+        vector<Vec4i> segments;
+        double baselineMs = timeEngine(img, SEGMENTS_HOUGH, 1, segments);
+        auto reference = findStrokes(segments);
+        report("hough", 1, baselineMs, baselineMs, segments, reference, reference, tolerance);
+
+        for (int threads = 1; threads <= defaultThreadCount(); threads *= 2) {
+            double ms = timeEngine(img, SEGMENTS_TILED, threads, segments);
+            report("tiled", threads, ms, baselineMs, segments, findStrokes(segments), reference, tolerance);
+        }
+
+        double ms = timeEngine(img, SEGMENTS_PYRAMID, 1, segments);
+        report("pyramid", 1, ms, baselineMs, segments, findStrokes(segments), reference, tolerance);
+
+        ms = timeEngine(img, SEGMENTS_RUNS, 1, segments);
+        report("runs", 1, ms, baselineMs, segments, findStrokes(segments), reference, tolerance);
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Times placeVotes on synthetic sketches of n hand-drawn boxes (4n
+// strokes), each with a word of text inside, to show how vote placement
+// scales with the number of strokes and text boxes.
+//
+// Usage: bench-voting [max-boxes]
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "../src/geometry.hpp"
+#include "../src/voting.hpp"
+#include "../src/util.hpp"
+
+using namespace cv;
+using namespace std;
+
+static int jitter() {
+    return rand() % 7 - 3;
+}
+
+static void addStroke(vector<Stroke>& strokes, Vec4i line) {
+    strokes.push_back(Stroke { line, angleOf(line) });
+}
+
+// boxes scattered over a page that grows with their number, so the
+// density of strokes stays about the same
+static vector<Stroke> sketch(int boxes, vector<TextBox>& text) {
+    int page = 400 * (int)ceil(sqrt(boxes));
+    vector<Stroke> strokes;
+    text.clear();
+    for (int i = 0; i < boxes; ++i) {
+        int x = rand() % page, y = rand() % page;
+        int w = 40 + rand() % 160, h = 40 + rand() % 160;
+        addStroke(strokes, Vec4i(x + jitter(),     y + jitter(),     x + w + jitter(), y + jitter()));
+        addStroke(strokes, Vec4i(x + jitter(),     y + h + jitter(), x + w + jitter(), y + h + jitter()));
+        addStroke(strokes, Vec4i(x + jitter(),     y + jitter(),     x + jitter(),     y + h + jitter()));
+        addStroke(strokes, Vec4i(x + w + jitter(), y + jitter(),     x + w + jitter(), y + h + jitter()));
+        text.push_back(TextBox { Rect(x + 10, y + 10, w / 2, 15), "word", 90 });
+    }
+    return strokes;
+}
+
+int main(int argc, char** argv) {
+    int maxBoxes = argc > 1 ? atoi(argv[1]) : 2500;
+    srand(1);
+    for (int boxes = 10; boxes <= maxBoxes; boxes *= 2) {
+        vector<TextBox> text;
+        auto strokes = sketch(boxes, text);
+        auto start = Clock::now();
+        auto votes = placeVotes(strokes, text);
+        double ms = millisSince(start);
+
+        int corners = 0;
+        for (auto& v : votes) {
+            corners += v.totalVotes;
+        }
+        cout << strokes.size() << " strokes, " << text.size() << " text boxes: " << ms << " ms, " << corners << " votes" << endl;
+    }
+    return 0;
+}
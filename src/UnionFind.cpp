@@ -34,3 +34,40 @@ void UnionFind::join(size_t x, size_t y) {
         }
     }
 }
+
+ConcurrentUnionFind::ConcurrentUnionFind(size_t count) : parents(count) {
+    for (size_t i = 0; i < count; ++i) {
+        parents[i].store(i); // every node links to itself
+    }
+}
+
+size_t ConcurrentUnionFind::find(size_t x) {
+    while (true) {
+        size_t parent = parents[x].load();
+        size_t grandparent = parents[parent].load();
+        if (parent == grandparent) {
+            return parent;
+        }
+        // path halving; losing this race to another thread is harmless
+        parents[x].compare_exchange_weak(parent, grandparent);
+        x = grandparent;
+    }
+}
+
+void ConcurrentUnionFind::join(size_t x, size_t y) {
+    while (true) {
+        x = find(x);
+        y = find(y);
+        if (x == y) {
+            return;
+        }
+        if (x < y) {
+            std::swap(x, y);
+        }
+        // only succeeds if x is still a root
+        size_t expected = x;
+        if (parents[x].compare_exchange_strong(expected, y)) {
+            return;
+        }
+    }
+}
@@ -1,8 +1,14 @@
 #ifndef UNIONFIND_H
 #define UNIONFIND_H 1
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <utility>
 #include <vector>
 
+#include "parallel.hpp"
+
 class UnionFind {
 public:
     UnionFind(size_t count);
@@ -13,6 +19,39 @@ private:
     std::vector<int> ranks;
 };
 
+/**
+ * Union-find that tolerates concurrent find and join calls. Parents are
+ * linked with compare-and-swap (always the larger root under the smaller,
+ * so the forest stays acyclic) and find does path halving.
+ */
+class ConcurrentUnionFind {
+public:
+    ConcurrentUnionFind(size_t count);
+    size_t find(size_t x);
+    void join(size_t x, size_t y);
+private:
+    std::vector<std::atomic<size_t>> parents;
+};
+
+// Gathers the sets in uf into groups of elements of v. Groups are ordered by
+// their first element, and elements keep their relative order.
+template <class T, class UF>
+std::vector<std::vector<T>> collectGroups(const std::vector<T>& v, UF& uf) {
+    std::vector<int> idxmap(v.size(), -1);
+    std::vector<std::vector<T>> vs;
+    for (size_t i = 0; i < v.size(); ++i) {
+        size_t set = uf.find(i);
+        int group = idxmap[set];
+        if (group < 0) {
+            idxmap[set] = vs.size();
+            vs.emplace_back(1, v[i]);
+        } else {
+            vs[group].push_back(v[i]);
+        }
+    }
+    return vs;
+}
+
 template <class T, class F>
 std::vector<std::vector<T>> group(std::vector<T> v, F similar) {
     UnionFind uf(v.size());
@@ -25,19 +64,83 @@ std::vector<std::vector<T>> group(std::vector<T> v, F similar) {
         }
     }
 
-    std::vector<int> idxmap(v.size(), -1);
-    std::vector<std::vector<T>> vs;
+    return collectGroups(v, uf);
+}
+
+// below this many elements threads cost more than they save
+static const size_t PARALLEL_GROUP_MIN = 128;
+
+/** axis-aligned bounding box, for groupSpatial */
+struct Extent {
+    double x0, y0, x1, y1;
+};
+
+// Tests the pairs of elements within cells[start, end), which all share a cell.
+template <class T, class F, class UF>
+void joinCell(const std::vector<T>& v, F& similar,
+        const std::vector<std::pair<unsigned long long, size_t>>& cells,
+        size_t start, size_t end, UF& uf) {
+    for (size_t a = start; a < end; ++a) {
+        for (size_t b = a + 1; b < end; ++b) {
+            size_t i = cells[a].second;
+            size_t j = cells[b].second;
+            // pairs can share several cells; skip those already joined
+            if (uf.find(i) != uf.find(j) && similar(v[i], v[j])) {
+                uf.join(i, j);
+            }
+        }
+    }
+}
+
+/**
+ * Computes exactly the same groups as group(v, similar), provided that
+ * similar(a, b) implies extentOf(a) and extentOf(b) are less than `radius`
+ * apart. Elements are bucketed into a grid of radius-sized cells (each one
+ * into every cell its extent, grown by radius/2, touches), and only pairs
+ * that share a cell are compared. With nthreads != 1 the cells are split
+ * among threads and `similar` is called concurrently.
+ */
+template <class T, class F, class E>
+std::vector<std::vector<T>> groupSpatial(std::vector<T> v, F similar, E extentOf, double radius, int nthreads = 1) {
+    // (cell, element) pairs, sorted so each cell's elements are adjacent
+    std::vector<std::pair<unsigned long long, size_t>> cells;
+    const double grow = radius / 2;
     for (size_t i = 0; i < v.size(); ++i) {
-        size_t set = uf.find(i);
-        int group = idxmap[set];
-        if (group < 0) {
-            idxmap[set] = vs.size();
-            vs.emplace_back(1, v[i]);
-        } else {
-            vs[group].push_back(v[i]);
+        Extent e = extentOf(v[i]);
+        long long cx0 = std::floor((e.x0 - grow) / radius);
+        long long cy0 = std::floor((e.y0 - grow) / radius);
+        long long cx1 = std::floor((e.x1 + grow) / radius);
+        long long cy1 = std::floor((e.y1 + grow) / radius);
+        for (long long cy = cy0; cy <= cy1; ++cy) {
+            for (long long cx = cx0; cx <= cx1; ++cx) {
+                cells.emplace_back(((unsigned long long)cx << 32) ^ (cy & 0xffffffff), i);
+            }
         }
     }
-    return vs;
+    std::sort(cells.begin(), cells.end());
+
+    // start of each cell's run in `cells`, plus the end
+    std::vector<size_t> runs;
+    for (size_t k = 0; k < cells.size(); ++k) {
+        if (k == 0 || cells[k].first != cells[k-1].first) {
+            runs.push_back(k);
+        }
+    }
+    runs.push_back(cells.size());
+
+    if (v.size() < PARALLEL_GROUP_MIN || nthreads == 1) {
+        UnionFind uf(v.size());
+        for (size_t r = 0; r + 1 < runs.size(); ++r) {
+            joinCell(v, similar, cells, runs[r], runs[r+1], uf);
+        }
+        return collectGroups(v, uf);
+    }
+
+    ConcurrentUnionFind uf(v.size());
+    parallelFor(runs.size() - 1, nthreads, [&](size_t r) {
+        joinCell(v, similar, cells, runs[r], runs[r+1], uf);
+    });
+    return collectGroups(v, uf);
 }
 
 #endif
@@ -0,0 +1,242 @@
+#include "batchgeometry.hpp"
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+SegmentArray::SegmentArray(const vector<Vec4i>& segments) {
+    x0.reserve(segments.size());
+    y0.reserve(segments.size());
+    x1.reserve(segments.size());
+    y1.reserve(segments.size());
+    for (auto& s : segments) {
+        push_back(s);
+    }
+}
+
+void SegmentArray::push_back(const Vec4i& segment) {
+    x0.push_back(segment[0]);
+    y0.push_back(segment[1]);
+    x1.push_back(segment[2]);
+    y1.push_back(segment[3]);
+}
+
+void SegmentArray::clear() {
+    x0.clear();
+    y0.clear();
+    x1.clear();
+    y1.clear();
+}
+
+// Lane types. Each provides load/store/splat, arithmetic, comparisons that
+// yield a Mask, mask logic, select(mask, a, b) and roundEven (round to the
+// nearest integer, ties to even, like cvRound).
+
+struct Scalar1 {
+    typedef bool Mask;
+    static const int N = 1;
+    double v;
+};
+static inline Scalar1 load(const double* p, Scalar1) { return Scalar1 { *p }; }
+static inline void store(double* p, Scalar1 a) { *p = a.v; }
+static inline Scalar1 splat(double x, Scalar1) { return Scalar1 { x }; }
+static inline Scalar1 operator+(Scalar1 a, Scalar1 b) { return Scalar1 { a.v + b.v }; }
+static inline Scalar1 operator-(Scalar1 a, Scalar1 b) { return Scalar1 { a.v - b.v }; }
+static inline Scalar1 operator*(Scalar1 a, Scalar1 b) { return Scalar1 { a.v * b.v }; }
+static inline Scalar1 operator/(Scalar1 a, Scalar1 b) { return Scalar1 { a.v / b.v }; }
+static inline Scalar1 operator-(Scalar1 a) { return Scalar1 { -a.v }; }
+static inline bool lt(Scalar1 a, Scalar1 b) { return a.v < b.v; }
+static inline bool gt(Scalar1 a, Scalar1 b) { return a.v > b.v; }
+static inline bool eq(Scalar1 a, Scalar1 b) { return a.v == b.v; }
+static inline bool both(bool a, bool b) { return a && b; }
+static inline bool either(bool a, bool b) { return a || b; }
+static inline bool butNot(bool a, bool b) { return a && !b; }
+static inline Scalar1 select(bool m, Scalar1 a, Scalar1 b) { return m ? a : b; }
+static inline Scalar1 abs(Scalar1 a) { return Scalar1 { std::abs(a.v) }; }
+static inline Scalar1 sqrt(Scalar1 a) { return Scalar1 { std::sqrt(a.v) }; }
+static inline Scalar1 roundEven(Scalar1 a) { return Scalar1 { std::rint(a.v) }; }
+static inline void storeMask(unsigned char* p, bool m) { *p = m; }
+
+#if defined(__AVX__)
+struct Lanes {
+    typedef Lanes Mask;
+    static const int N = 4;
+    __m256d v;
+};
+static inline Lanes load(const double* p, Lanes) { return Lanes { _mm256_loadu_pd(p) }; }
+static inline void store(double* p, Lanes a) { _mm256_storeu_pd(p, a.v); }
+static inline Lanes splat(double x, Lanes) { return Lanes { _mm256_set1_pd(x) }; }
+static inline Lanes operator+(Lanes a, Lanes b) { return Lanes { _mm256_add_pd(a.v, b.v) }; }
+static inline Lanes operator-(Lanes a, Lanes b) { return Lanes { _mm256_sub_pd(a.v, b.v) }; }
+static inline Lanes operator*(Lanes a, Lanes b) { return Lanes { _mm256_mul_pd(a.v, b.v) }; }
+static inline Lanes operator/(Lanes a, Lanes b) { return Lanes { _mm256_div_pd(a.v, b.v) }; }
+static inline Lanes operator-(Lanes a) { return Lanes { _mm256_xor_pd(a.v, _mm256_set1_pd(-0.0)) }; }
+static inline Lanes lt(Lanes a, Lanes b) { return Lanes { _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ) }; }
+static inline Lanes gt(Lanes a, Lanes b) { return Lanes { _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ) }; }
+static inline Lanes eq(Lanes a, Lanes b) { return Lanes { _mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ) }; }
+static inline Lanes both(Lanes a, Lanes b) { return Lanes { _mm256_and_pd(a.v, b.v) }; }
+static inline Lanes either(Lanes a, Lanes b) { return Lanes { _mm256_or_pd(a.v, b.v) }; }
+static inline Lanes butNot(Lanes a, Lanes b) { return Lanes { _mm256_andnot_pd(b.v, a.v) }; }
+static inline Lanes select(Lanes m, Lanes a, Lanes b) { return Lanes { _mm256_blendv_pd(b.v, a.v, m.v) }; }
+static inline Lanes abs(Lanes a) { return Lanes { _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v) }; }
+static inline Lanes sqrt(Lanes a) { return Lanes { _mm256_sqrt_pd(a.v) }; }
+static inline Lanes roundEven(Lanes a) { return Lanes { _mm256_round_pd(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) }; }
+static inline void storeMask(unsigned char* p, Lanes m) {
+    int bits = _mm256_movemask_pd(m.v);
+    for (int i = 0; i < 4; ++i) {
+        p[i] = (bits >> i) & 1;
+    }
+}
+#elif defined(__SSE2__)
+struct Lanes {
+    typedef Lanes Mask;
+    static const int N = 2;
+    __m128d v;
+};
+static inline Lanes load(const double* p, Lanes) { return Lanes { _mm_loadu_pd(p) }; }
+static inline void store(double* p, Lanes a) { _mm_storeu_pd(p, a.v); }
+static inline Lanes splat(double x, Lanes) { return Lanes { _mm_set1_pd(x) }; }
+static inline Lanes operator+(Lanes a, Lanes b) { return Lanes { _mm_add_pd(a.v, b.v) }; }
+static inline Lanes operator-(Lanes a, Lanes b) { return Lanes { _mm_sub_pd(a.v, b.v) }; }
+static inline Lanes operator*(Lanes a, Lanes b) { return Lanes { _mm_mul_pd(a.v, b.v) }; }
+static inline Lanes operator/(Lanes a, Lanes b) { return Lanes { _mm_div_pd(a.v, b.v) }; }
+static inline Lanes operator-(Lanes a) { return Lanes { _mm_xor_pd(a.v, _mm_set1_pd(-0.0)) }; }
+static inline Lanes lt(Lanes a, Lanes b) { return Lanes { _mm_cmplt_pd(a.v, b.v) }; }
+static inline Lanes gt(Lanes a, Lanes b) { return Lanes { _mm_cmpgt_pd(a.v, b.v) }; }
+static inline Lanes eq(Lanes a, Lanes b) { return Lanes { _mm_cmpeq_pd(a.v, b.v) }; }
+static inline Lanes both(Lanes a, Lanes b) { return Lanes { _mm_and_pd(a.v, b.v) }; }
+static inline Lanes either(Lanes a, Lanes b) { return Lanes { _mm_or_pd(a.v, b.v) }; }
+static inline Lanes butNot(Lanes a, Lanes b) { return Lanes { _mm_andnot_pd(b.v, a.v) }; }
+static inline Lanes select(Lanes m, Lanes a, Lanes b) { return Lanes { _mm_or_pd(_mm_and_pd(m.v, a.v), _mm_andnot_pd(m.v, b.v)) }; }
+static inline Lanes abs(Lanes a) { return Lanes { _mm_andnot_pd(_mm_set1_pd(-0.0), a.v) }; }
+static inline Lanes sqrt(Lanes a) { return Lanes { _mm_sqrt_pd(a.v) }; }
+static inline Lanes roundEven(Lanes a) {
+    // adding and subtracting 1.5 * 2^52 rounds to an integer (ties to even)
+    // for every |x| < 2^51, which covers any pixel coordinate
+    const __m128d magic = _mm_set1_pd(6755399441055744.0);
+    return Lanes { _mm_sub_pd(_mm_add_pd(a.v, magic), magic) };
+}
+static inline void storeMask(unsigned char* p, Lanes m) {
+    int bits = _mm_movemask_pd(m.v);
+    p[0] = bits & 1;
+    p[1] = (bits >> 1) & 1;
+}
+#else
+typedef Scalar1 Lanes;
+#endif
+
+// A branch-free transcription of closestApproach (see geometry.hpp); every
+// `if` there is a select here.
+template <class L>
+static inline L closestApproachLanes(L qx0, L qy0, L qx1, L qy1, L x0, L y0, L x1, L y1) {
+    typedef typename L::Mask M;
+    const L zero = splat(0.0, L());
+    const L one = splat(1.0, L());
+    const L SMALL_NUM = splat(0.0001, L());
+
+    const L ux = qx1 - qx0, uy = qy1 - qy0;
+    const L vx = x1 - x0,   vy = y1 - y0;
+    const L wx = qx0 - x0,  wy = qy0 - y0;
+    const L a = ux*ux + uy*uy;
+    const L b = ux*vx + uy*vy;
+    const L c = vx*vx + vy*vy;
+    const L d = ux*wx + uy*wy;
+    const L e = vx*wx + vy*wy;
+    const L D = a*c - b*b;
+
+    const M parallel = lt(D, SMALL_NUM);
+    L sN = select(parallel, zero, b*e - c*d);
+    L sD = select(parallel, one, D);
+    L tN = select(parallel, e, a*e - b*d);
+    L tD = select(parallel, c, D);
+
+    const M sLow = butNot(lt(sN, zero), parallel);
+    const M sHigh = butNot(butNot(gt(sN, sD), parallel), sLow);
+    tN = select(sLow, e, select(sHigh, e + b, tN));
+    tD = select(either(sLow, sHigh), c, tD);
+    sN = select(sLow, zero, select(sHigh, sD, sN));
+
+    const L md = -d;
+    const L mdb = md + b;
+    const M tLow = lt(tN, zero);
+    const M tHigh = butNot(gt(tN, tD), tLow);
+    tN = select(tLow, zero, select(tHigh, tD, tN));
+
+    // the same clamp of s against edge t=0 (using -d) or edge t=1 (using -d+b)
+    const L edge = select(tLow, md, mdb);
+    const M edgeCase = either(tLow, tHigh);
+    const M below = both(edgeCase, lt(edge, zero));
+    const M above = butNot(both(edgeCase, gt(edge, a)), below);
+    const M inside = butNot(butNot(edgeCase, below), above);
+    sN = select(below, zero, select(above, sD, select(inside, edge, sN)));
+    sD = select(inside, a, sD);
+
+    const L sc = select(lt(abs(sN), SMALL_NUM), zero, sN / sD);
+    const L tc = select(lt(abs(tN), SMALL_NUM), zero, tN / tD);
+
+    // closestApproach on integer segments rounds sc*u and tc*v to integers
+    const L dx = wx + roundEven(sc * ux) - roundEven(tc * vx);
+    const L dy = wy + roundEven(sc * uy) - roundEven(tc * vy);
+    return sqrt(dx*dx + dy*dy);
+}
+
+template <class L>
+static size_t closestApproachRange(size_t i, const Vec4d& q, const SegmentArray& s, double* out) {
+    const L qx0 = splat(q[0], L()), qy0 = splat(q[1], L());
+    const L qx1 = splat(q[2], L()), qy1 = splat(q[3], L());
+    for (; i + L::N <= s.size(); i += L::N) {
+        store(out + i, closestApproachLanes(qx0, qy0, qx1, qy1,
+            load(&s.x0[i], L()), load(&s.y0[i], L()),
+            load(&s.x1[i], L()), load(&s.y1[i], L())));
+    }
+    return i;
+}
+
+static void closestApproachAll(const Vec4d& query, const SegmentArray& segments, double* out) {
+    size_t i = closestApproachRange<Lanes>(0, query, segments, out);
+    closestApproachRange<Scalar1>(i, query, segments, out);
+}
+
+void batchClosestApproach(const Vec4i& query, const SegmentArray& segments, double* out) {
+    closestApproachAll(Vec4d(query[0], query[1], query[2], query[3]), segments, out);
+}
+
+void batchClosestApproach(const Vec2i& point, const SegmentArray& segments, double* out) {
+    closestApproachAll(Vec4d(point[0], point[1], point[0], point[1]), segments, out);
+}
+
+void batchAngleOf(const SegmentArray& segments, double* out) {
+    // there is no vector atan2 to call, but the loop still streams through
+    // contiguous arrays
+    for (size_t i = 0; i < segments.size(); ++i) {
+        out[i] = atan2(segments.y1[i] - segments.y0[i], segments.x1[i] - segments.x0[i]);
+    }
+}
+
+// |cos(angleOf(s))| > |cos(45)|, without the trigonometry:
+// dx^2 > cos(45)^2 * (dx^2 + dy^2). A zero-length segment has angle 0.
+template <class L>
+static size_t mostlyHorizontalRange(size_t i, const SegmentArray& s, unsigned char* out) {
+    const double k = std::cos(45.0);
+    const L k2 = splat(k * k, L());
+    const L zero = splat(0.0, L());
+    for (; i + L::N <= s.size(); i += L::N) {
+        L dx = load(&s.x1[i], L()) - load(&s.x0[i], L());
+        L dy = load(&s.y1[i], L()) - load(&s.y0[i], L());
+        L dx2 = dx * dx;
+        L len2 = dx2 + dy * dy;
+        storeMask(out + i, either(gt(dx2, k2 * len2), eq(len2, zero)));
+    }
+    return i;
+}
+
+void batchMostlyHorizontal(const SegmentArray& segments, unsigned char* out) {
+    size_t i = mostlyHorizontalRange<Lanes>(0, segments, out);
+    mostlyHorizontalRange<Scalar1>(i, segments, out);
+}
@@ -0,0 +1,42 @@
+#ifndef BATCHGEOMETRY_H
+#define BATCHGEOMETRY_H 1
+
+// Geometry kernels that evaluate one query against many segments at once.
+// Segments are stored coordinate-by-coordinate so the kernels can process
+// several of them per instruction (4 with AVX, 2 with SSE2, 1 otherwise).
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+struct SegmentArray {
+    std::vector<double> x0, y0, x1, y1;
+
+    SegmentArray() { }
+    SegmentArray(const std::vector<cv::Vec4i>& segments);
+
+    size_t size() const { return x0.size(); }
+    void push_back(const cv::Vec4i& segment);
+    void clear();
+};
+
+/**
+ * The batch kernels reproduce closestApproach, angleOf and mostlyHorizontal
+ * on integer segments (including closestApproach's rounding of the closest
+ * points to whole pixels). The only differences come from floating-point
+ * contraction, and stay within BATCH_EPSILON relative error.
+ */
+static const double BATCH_EPSILON = 1e-9;
+
+/** out[i] = closestApproach(query, segments[i]) */
+void batchClosestApproach(const cv::Vec4i& query, const SegmentArray& segments, double* out);
+
+/** out[i] = closestApproach(point, segments[i]) */
+void batchClosestApproach(const cv::Vec2i& point, const SegmentArray& segments, double* out);
+
+/** out[i] = angleOf(segments[i]) */
+void batchAngleOf(const SegmentArray& segments, double* out);
+
+/** out[i] = mostlyHorizontal(segments[i]) */
+void batchMostlyHorizontal(const SegmentArray& segments, unsigned char* out);
+
+#endif
@@ -1,38 +1,180 @@
 #include "constraints.hpp"
-#include "geometry.hpp"
+#include <algorithm>
+#include <unordered_set>
+#include <utility>
 
 using namespace std;
 using namespace cv;
 
 static const Length ZERO { UNIT_PX, 0.0 };
 
-static bool contains(LayoutObject* o1, LayoutObject* o2) {
-    auto& box1 = o1->data.boxData;
-    auto& box2 = o2->data.boxData;
-    return contains(
-        Rect(Point(box1[0], box1[1]), Size(box1[2], box1[3])),
-        Rect(Point(box2[0], box2[1]), Size(box2[2], box2[3])));
+// a box's edges, which may be in either order (boxes can have negative sizes)
+struct Edges {
+    int x0, y0, x1, y1;
+};
+
+static Edges edgesOf(const LayoutObject* o) {
+    auto& box = o->data.boxData;
+    return Edges { box[0], box[1], box[0] + box[2], box[1] + box[3] };
+}
+
+// the same test as contains(Rect, Rect)
+static bool contains(const Edges& e1, const Edges& e2) {
+    return e1.x0 <= e2.x0 && e1.y0 <= e2.y0 && e1.x1 >= e2.x1 && e1.y1 >= e2.y1;
 }
 
-static void findContainmentConstraints(const vector<LayoutObject*>& objects, vector<Constraint>& dst) {
+/**
+ * Every pair (i, j) where box i contains box j, each box and itself
+ * included, sorted. Boxes are swept from top to bottom, and each one is
+ * only tested against the boxes that start above it (or level with it)
+ * and haven't ended yet, and of those only the ones that start left of it
+ * (or level with it). So only boxes side by side in one row are compared
+ * with each other, not boxes stacked in a column.
+ */
+static vector<pair<size_t, size_t>> containedPairs(const vector<Edges>& boxes) {
+    vector<pair<size_t, size_t>> result;
+
+    // boxes that end before they start are tested against every box
+    vector<size_t> order, inverted;
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        (boxes[i].y1 < boxes[i].y0 ? inverted : order).push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [&boxes](size_t i, size_t j) { return boxes[i].y0 < boxes[j].y0; });
 
-    for (auto o1 : objects) {
-        for (auto o2 : objects) {
-            if (o1->type == LAYOUT_BOX && o2->type == LAYOUT_BOX && contains(o1, o2)) {
-                dst.push_back(Constraint { CONSTRAINT_CONTAINS, o1, o2, ZERO });
-                dst.push_back(Constraint { CONSTRAINT_WIDTH, o2, nullptr, Length { UNIT_PERCENT, o2->data.boxData[2] * 100.0 / o1->data.boxData[2] }});
-                dst.push_back(Constraint { CONSTRAINT_PAD_LEFT, o1, o2, Length { UNIT_PERCENT, (o2->data.boxData[0] - o1->data.boxData[0]) * 100.0 / o1->data.boxData[2] }});
-                dst.push_back(Constraint { CONSTRAINT_PAD_TOP, o1, o2, Length { UNIT_PX, static_cast<double>(o2->data.boxData[1] - o1->data.boxData[1]) }});
+    // the boxes that span the sweep line, by left edge
+    vector<size_t> active;
+    auto startingBy = [&](int x) {
+        return partition_point(active.begin(), active.end(), [&](size_t i) { return boxes[i].x0 <= x; });
+    };
+    for (size_t start = 0, end; start < order.size(); start = end) {
+        int y = boxes[order[start]].y0;
+        // a box that ends above y can't contain any box starting from y on
+        active.erase(remove_if(active.begin(), active.end(), [&](size_t i) { return boxes[i].y1 < y; }), active.end());
+        for (end = start; end < order.size() && boxes[order[end]].y0 == y; ++end) {
+            size_t j = order[end];
+            active.insert(startingBy(boxes[j].x0), j);
+        }
+        for (size_t k = start; k < end; ++k) {
+            size_t j = order[k];
+            for (auto it = active.begin(), left = startingBy(boxes[j].x0); it != left; ++it) {
+                if (contains(boxes[*it], boxes[j])) {
+                    result.emplace_back(*it, j);
+                }
             }
         }
     }
 
+    for (size_t j : inverted) {
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            if (contains(boxes[i], boxes[j])) {
+                result.emplace_back(i, j);
+            }
+            if (contains(boxes[j], boxes[i])) {
+                result.emplace_back(j, i);
+            }
+        }
+    }
+
+    sort(result.begin(), result.end());
+    result.erase(unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// Box i contains box j and isn't equal to it.
+static bool strictlyContains(const vector<Edges>& boxes, size_t i, size_t j) {
+    return contains(boxes[i], boxes[j]) && !contains(boxes[j], boxes[i]);
+}
+
+/**
+ * The pairs of `pairs` (from containedPairs) that the rest follow from
+ * transitively, in the same order: equal boxes each contain the other, and
+ * box i contains box j if it strictly contains it with no box in between.
+ * So o1 still contains o2 through these exactly when it does in `pairs`,
+ * and each box is still given its margins within every box equal to its
+ * nearest container.
+ */
+static vector<pair<size_t, size_t>> transitiveReduction(const vector<Edges>& boxes, const vector<pair<size_t, size_t>>& pairs) {
+    vector<vector<size_t>> containers(boxes.size());
+    for (auto& p : pairs) {
+        if (strictlyContains(boxes, p.first, p.second)) {
+            containers[p.second].push_back(p.first);
+        }
+    }
+
+    // a container of j that strictly contains another container of j isn't
+    // j's parent
+    vector<pair<size_t, size_t>> result;
+    for (auto& p : pairs) {
+        size_t i = p.first, j = p.second;
+        if (i == j) {
+            continue;
+        }
+        bool direct = true;
+        if (strictlyContains(boxes, i, j)) {
+            for (size_t k : containers[j]) {
+                if (strictlyContains(boxes, i, k)) {
+                    direct = false;
+                    break;
+                }
+            }
+        }
+        if (direct) {
+            result.push_back(p);
+        }
+    }
+    return result;
+}
+
+static void findContainmentConstraints(const vector<LayoutObject*>& objects, const ConstraintOptions& options, vector<Constraint>& dst) {
+    vector<LayoutObject*> boxes;
+    vector<Edges> edges;
+    for (auto o : objects) {
+        if (o->type == LAYOUT_BOX) {
+            boxes.push_back(o);
+            edges.push_back(edgesOf(o));
+        }
+    }
+
+    auto width = [](const LayoutObject* container, const LayoutObject* o) {
+        return Length { UNIT_PERCENT, o->data.boxData[2] * 100.0 / container->data.boxData[2] };
+    };
+    auto pairs = containedPairs(edges);
+    if (options.fullContainment) {
+        for (auto& p : pairs) {
+            LayoutObject* o1 = boxes[p.first];
+            LayoutObject* o2 = boxes[p.second];
+            dst.push_back(Constraint { CONSTRAINT_CONTAINS, o1, o2, ZERO });
+            dst.push_back(Constraint { CONSTRAINT_WIDTH, o2, nullptr, width(o1, o2) });
+            dst.push_back(Constraint { CONSTRAINT_PAD_LEFT, o1, o2, Length { UNIT_PERCENT, (o2->data.boxData[0] - o1->data.boxData[0]) * 100.0 / o1->data.boxData[2] }});
+            dst.push_back(Constraint { CONSTRAINT_PAD_TOP, o1, o2, Length { UNIT_PX, static_cast<double>(o2->data.boxData[1] - o1->data.boxData[1]) }});
+        }
+        return;
+    }
+
+    // Of a box's full containment constraints, the last width wins: the one
+    // relative to the last box containing it, usually itself (so 100%).
+    // Give each box just that one.
+    vector<size_t> widthBase(boxes.size(), 0);
+    for (auto& p : pairs) {
+        widthBase[p.second] = max(widthBase[p.second], p.first);
+    }
+    for (size_t j = 0; j < boxes.size(); ++j) {
+        dst.push_back(Constraint { CONSTRAINT_WIDTH, boxes[j], nullptr, width(boxes[widthBase[j]], boxes[j]) });
+    }
+
+    for (auto& p : transitiveReduction(edges, pairs)) {
+        LayoutObject* o1 = boxes[p.first];
+        LayoutObject* o2 = boxes[p.second];
+        dst.push_back(Constraint { CONSTRAINT_CONTAINS, o1, o2, ZERO });
+        dst.push_back(Constraint { CONSTRAINT_PAD_LEFT, o1, o2, Length { UNIT_PERCENT, (o2->data.boxData[0] - o1->data.boxData[0]) * 100.0 / o1->data.boxData[2] }});
+        dst.push_back(Constraint { CONSTRAINT_PAD_TOP, o1, o2, Length { UNIT_PX, static_cast<double>(o2->data.boxData[1] - o1->data.boxData[1]) }});
+    }
 }
 
-vector<Constraint> formConstraints(const vector<LayoutObject*>& objects) {
+vector<Constraint> formConstraints(const vector<LayoutObject*>& objects, const ConstraintOptions& options) {
     vector<Constraint> result;
 
-    findContainmentConstraints(objects, result);
+    findContainmentConstraints(objects, options, result);
 
     for (auto o : objects) {
         result.push_back(Constraint { CONSTRAINT_HEIGHT, o, nullptr, Length { UNIT_PX, static_cast<double>(o->data.boxData[3]) }});
@@ -40,3 +182,61 @@ vector<Constraint> formConstraints(const vector<LayoutObject*>& objects) {
 
     return result;
 }
+
+ConstraintGraph::ConstraintGraph(const vector<Constraint>& constraints) {
+    for (auto& c : constraints) {
+        if (c.type == CONSTRAINT_CONTAINS) {
+            contained[c.obj1].push_back(c.obj2);
+        } else {
+            // sizes ignore obj2
+            bool size = c.type == CONSTRAINT_WIDTH || c.type == CONSTRAINT_HEIGHT;
+            lengths[Key(c.type, c.obj1, size ? nullptr : c.obj2)] = c.len;
+        }
+    }
+}
+
+const vector<const LayoutObject*>& ConstraintGraph::children(const LayoutObject* o) const {
+    static const vector<const LayoutObject*> none;
+    auto it = contained.find(o);
+    return it == contained.end() ? none : it->second;
+}
+
+bool ConstraintGraph::contains(const LayoutObject* o1, const LayoutObject* o2) const {
+    vector<const LayoutObject*> todo { o1 };
+    unordered_set<const LayoutObject*> seen { o1 };
+    while (!todo.empty()) {
+        const LayoutObject* o = todo.back();
+        todo.pop_back();
+        for (auto child : children(o)) {
+            if (child == o2) {
+                return true;
+            }
+            if (seen.insert(child).second) {
+                todo.push_back(child);
+            }
+        }
+    }
+    return false;
+}
+
+vector<const LayoutObject*> ConstraintGraph::containedIn(const LayoutObject* o) const {
+    vector<const LayoutObject*> result;
+    unordered_set<const LayoutObject*> seen;
+    vector<const LayoutObject*> todo { o };
+    while (!todo.empty()) {
+        const LayoutObject* next = todo.back();
+        todo.pop_back();
+        for (auto child : children(next)) {
+            if (seen.insert(child).second) {
+                result.push_back(child);
+                todo.push_back(child);
+            }
+        }
+    }
+    return result;
+}
+
+const Length* ConstraintGraph::length(ConstraintType type, const LayoutObject* o1, const LayoutObject* o2) const {
+    auto it = lengths.find(Key(type, o1, o2));
+    return it == lengths.end() ? nullptr : &it->second;
+}
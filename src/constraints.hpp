@@ -1,6 +1,9 @@
 #ifndef CONSTRAINTS_H
 #define CONSTRAINTS_H 1
 
+#include <functional>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "explanation.hpp"
@@ -34,6 +37,60 @@ struct Constraint {
     Length len;
 };
 
-std::vector<Constraint> formConstraints(const std::vector<LayoutObject*>& objects);
+struct ConstraintOptions {
+    // Emit containment (and the size and padding that go with it) for every
+    // pair of boxes where one contains the other, each box and itself
+    // included. Otherwise only each box's nearest containers (and the boxes
+    // equal to it) are given, the rest of the containment follows from those
+    // transitively, and each box gets the one width the full constraints
+    // would have left it with; the layout comes out the same.
+    bool fullContainment = false;
+};
+
+/**
+ * Constraints indexed by the objects they are about: each object's
+ * containment edges, and every length by (type, obj1, obj2). Where the
+ * same kind of constraint was given twice, the last one wins, as it would
+ * when applying the constraints in order.
+ */
+class ConstraintGraph {
+public:
+    ConstraintGraph(const std::vector<Constraint>& constraints);
+
+    /** whether o1 contains o2, directly or through objects in between */
+    bool contains(const LayoutObject* o1, const LayoutObject* o2) const;
+
+    /**
+     * Everything `o` contains, directly or through objects in between (and
+     * so `o` itself only if it contains itself), each once.
+     */
+    std::vector<const LayoutObject*> containedIn(const LayoutObject* o) const;
+
+    /**
+     * The length of the constraint of `type` on o1 and o2 (nullptr for
+     * sizes), or nullptr if there is none.
+     */
+    const Length* length(ConstraintType type, const LayoutObject* o1, const LayoutObject* o2 = nullptr) const;
+
+private:
+    typedef std::tuple<ConstraintType, const LayoutObject*, const LayoutObject*> Key;
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            std::hash<const LayoutObject*> h;
+            size_t seed = std::get<0>(k);
+            seed ^= h(std::get<1>(k)) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            seed ^= h(std::get<2>(k)) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            return seed;
+        }
+    };
+
+    const std::vector<const LayoutObject*>& children(const LayoutObject* o) const;
+
+    std::unordered_map<const LayoutObject*, std::vector<const LayoutObject*>> contained;
+    std::unordered_map<Key, Length, KeyHash> lengths;
+};
+
+std::vector<Constraint> formConstraints(const std::vector<LayoutObject*>& objects, const ConstraintOptions& options = ConstraintOptions());
 
 #endif
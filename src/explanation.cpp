@@ -2,7 +2,17 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include "batchgeometry.hpp"
 #include "geometry.hpp"
+#include "parallel.hpp"
+#include "UnionFind.hpp"
 
 using namespace std;
 using namespace cv;
@@ -21,23 +31,11 @@ Vec4i getLine(const LayoutObject* box, MeasurementRel relation) {
 }
 
 bool hasBestVote(const VotedStroke& s, VoteType type) {
-    VoteType best = bestVote(s)->type;
-    int bestCount = 0;
-    int tyCount = 0;
-    for (auto& v : s.votes) {
-        if (v.type == best) ++bestCount;
-        if (v.type == type) ++tyCount;
-    }
-    return tyCount == bestCount;
+    return s.votes[type] == s.votes[bestVote(s)];
 }
 
 bool hasVote(const VotedStroke& s, VoteType type) {
-    for (auto& v : s.votes) {
-        if (v.type == type) {
-            return true;
-        }
-    }
-    return false;
+    return s.votes[type] > 0;
 }
 
 int estimateBoxCount(const vector<VotedStroke>& strokes) {
@@ -53,16 +51,6 @@ int estimateBoxCount(const vector<VotedStroke>& strokes) {
     return min(min(ntops, nlefts), min(nrights, nbots));
 }
 
-vector<VotedStroke> findByVote(const vector<VotedStroke>& strokes, VoteType vote) {
-    vector<VotedStroke> result;
-    for (auto& s : strokes) {
-        if (hasVote(s, vote)) {
-            result.push_back(s);
-        }
-    }
-    return result;
-}
-
 double scoreBox(const VotedStroke& top, const VotedStroke& left, const VotedStroke& right, const VotedStroke& bot) {
     return
       -(closestApproach(top.stroke.line, left.stroke.line) +
@@ -71,31 +59,314 @@ double scoreBox(const VotedStroke& top, const VotedStroke& left, const VotedStro
         closestApproach(right.stroke.line, top.stroke.line));
 }
 
-LayoutObject* findBestBox(vector<VotedStroke>& strokes) {
+// Joins closer than this are computed once per explain and kept; farther
+// ones are recomputed when needed, which is rare since no good box has one.
+static const double JOIN_CACHE_REACH = 100;
+
+/**
+ * closestApproach(a, b) between strokes in two roles of a box (say, tops
+ * and lefts), looked up by stroke index. Pairs closer than
+ * JOIN_CACHE_REACH are stored, by row and by column; any other pair is at
+ * least that far apart, which is all the search's bounds need to know.
+ */
+class JoinCache {
+public:
+    JoinCache(const vector<VotedStroke>& strokes, const vector<size_t>& as, const vector<size_t>& bs)
+        : strokes(strokes), rows(strokes.size()), columns(strokes.size()), hitCount(0), missCount(0) {
+
+        // Two strokes can only be that close if their bounding boxes are, so
+        // bucket the bs into a grid of JOIN_CACHE_REACH-sized cells and only
+        // measure the ones in cells near each a.
+        auto cellOf = [](double v) { return (long long)floor(v / JOIN_CACHE_REACH); };
+        auto key = [](long long cx, long long cy) { return ((unsigned long long)cx << 32) ^ (cy & 0xffffffff); };
+        auto cellsNear = [&](const Vec4i& l, double reach, function<void(unsigned long long)> f) {
+            long long cx1 = cellOf(max(l[0], l[2]) + reach), cy1 = cellOf(max(l[1], l[3]) + reach);
+            for (long long cy = cellOf(min(l[1], l[3]) - reach); cy <= cy1; ++cy) {
+                for (long long cx = cellOf(min(l[0], l[2]) - reach); cx <= cx1; ++cx) {
+                    f(key(cx, cy));
+                }
+            }
+        };
+        unordered_map<unsigned long long, vector<size_t>> grid; // cell to positions in bs
+        for (size_t j = 0; j < bs.size(); ++j) {
+            cellsNear(strokes[bs[j]].stroke.line, 0, [&](unsigned long long cell) { grid[cell].push_back(j); });
+        }
+
+        vector<size_t> seenBy(bs.size(), as.size()), near;
+        SegmentArray nearLines;
+        vector<double> d;
+        for (size_t i = 0; i < as.size(); ++i) {
+            const Vec4i& line = strokes[as[i]].stroke.line;
+            near.clear();
+            cellsNear(line, JOIN_CACHE_REACH, [&](unsigned long long cell) {
+                auto it = grid.find(cell);
+                if (it != grid.end()) {
+                    for (size_t j : it->second) {
+                        if (seenBy[j] != i) {
+                            seenBy[j] = i;
+                            near.push_back(j);
+                        }
+                    }
+                }
+            });
+            // in index order, so rows (and columns) stay sorted
+            sort(near.begin(), near.end());
+            nearLines.clear();
+            for (size_t j : near) {
+                nearLines.push_back(strokes[bs[j]].stroke.line);
+            }
+            d.resize(near.size());
+            batchClosestApproach(line, nearLines, d.data());
+            for (size_t k = 0; k < near.size(); ++k) {
+                if (d[k] < JOIN_CACHE_REACH) {
+                    rows[as[i]].push_back(make_pair(bs[near[k]], d[k]));
+                    columns[bs[near[k]]].push_back(make_pair(as[i], d[k]));
+                }
+            }
+        }
+    }
+
+    double get(size_t a, size_t b) {
+        const vector<pair<size_t, double>>& row = rows[a];
+        auto it = lower_bound(row.begin(), row.end(), make_pair(b, -1.0));
+        if (it != row.end() && it->first == b) {
+            ++hitCount;
+            return it->second;
+        }
+        ++missCount;
+        return closestApproach(strokes[a].stroke.line, strokes[b].stroke.line);
+    }
+
+    // Lower bounds on how near the nearest live partner of `a` (as the
+    // first argument) or of `b` (as the second) is. If that partner is
+    // cached it is stored in `partner`.
+    double nearestInRow(size_t a, const vector<bool>& alive, size_t* partner = nullptr) const {
+        return nearest(rows, a, alive, partner);
+    }
+
+    double nearestInColumn(size_t b, const vector<bool>& alive, size_t* partner = nullptr) const {
+        return nearest(columns, b, alive, partner);
+    }
+
+    // the cached pairs in the row of `a`, by partner index
+    const vector<pair<size_t, double>>& row(size_t a) const {
+        return rows[a];
+    }
+
+    unsigned long hits() const { return hitCount; }
+    unsigned long misses() const { return missCount; }
+
+private:
+    // by stroke index; strokes not in the role have empty lists
+    typedef vector<vector<pair<size_t, double>>> Lists;
+
+    static double nearest(const Lists& lists, size_t i, const vector<bool>& alive, size_t* partner) {
+        double best = JOIN_CACHE_REACH;
+        for (auto& p : lists[i]) {
+            if (alive[p.first] && p.second < best) {
+                best = p.second;
+                if (partner != nullptr) {
+                    *partner = p.first;
+                }
+            }
+        }
+        return best;
+    }
+
+    const vector<VotedStroke>& strokes;
+    Lists rows, columns;
+    unsigned long hitCount, missCount;
+};
+
+static vector<size_t> withVote(const vector<VotedStroke>& strokes, VoteType vote) {
+    vector<size_t> result;
+    for (size_t i = 0; i < strokes.size(); ++i) {
+        if (hasVote(strokes[i], vote)) {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+/**
+ * Everything findBestBox needs across the boxes of one explain: which
+ * strokes voted for each side (as indices into `strokes`, in order), which
+ * strokes are already explained, and the joins between sides.
+ */
+struct BoxSearch {
+    const vector<VotedStroke>& strokes;
+    vector<bool> alive;
+    vector<size_t> tops, lefts, rights, bots;
+    JoinCache TL, LB, BR, RT;
+
+    // for each stroke, the strokes equal to it (itself included), in order
+    vector<vector<size_t>> equals;
+
+    // lower bounds on each stroke's cheapest joins, refilled for every box
+    vector<double> minTL, minRT, minLB, minBR;
+
+    BoxSearch(const vector<VotedStroke>& strokes)
+        : strokes(strokes),
+          alive(strokes.size(), true),
+          tops(withVote(strokes, BOX_TOP)),
+          lefts(withVote(strokes, BOX_LEFT)),
+          rights(withVote(strokes, BOX_RIGHT)),
+          bots(withVote(strokes, BOX_BOTTOM)),
+          // the four terms of scoreBox, with the same argument order so
+          // that scores match scoreBox's (to within BATCH_EPSILON)
+          TL(strokes, tops, lefts),
+          LB(strokes, lefts, bots),
+          BR(strokes, bots, rights),
+          RT(strokes, rights, tops),
+          equals(strokes.size()),
+          minTL(strokes.size()), minRT(strokes.size()), minLB(strokes.size()), minBR(strokes.size()) {
+
+        // sort by value to find the equal strokes, then list them in order
+        vector<size_t> byValue(strokes.size());
+        for (size_t i = 0; i < strokes.size(); ++i) {
+            byValue[i] = i;
+        }
+        auto key = [&strokes](size_t i) {
+            const Vec4i& l = strokes[i].stroke.line;
+            return make_tuple(l[0], l[1], l[2], l[3], strokes[i].stroke.angle, strokes[i].totalVotes, i);
+        };
+        sort(byValue.begin(), byValue.end(), [&key](size_t i, size_t j) { return key(i) < key(j); });
+        for (size_t start = 0, end; start < byValue.size(); start = end) {
+            vector<size_t> same;
+            for (end = start; end < byValue.size() && strokes[byValue[end]] == strokes[byValue[start]]; ++end) {
+                same.push_back(byValue[end]);
+            }
+            for (size_t i : same) {
+                equals[i] = same;
+            }
+        }
+    }
+
+    // Marks the first live stroke equal to strokes[i] as explained. That
+    // isn't always strokes[i] itself: explain used to erase strokes by
+    // value, and this keeps its results the same.
+    void kill(size_t i) {
+        for (size_t j : equals[i]) {
+            if (alive[j]) {
+                alive[j] = false;
+                return;
+            }
+        }
+    }
+};
+
+// Bounds are sums taken in a different order than the scores, so they are
+// only trusted to within this much.
+static const double BOUND_SLACK = 1e-6;
+
+static LayoutObject* findBestBox(BoxSearch& search, ostream& log) {
     LayoutObject obj;
     obj.type = LAYOUT_BOX;
 
-    auto tops   = findByVote(strokes, BOX_TOP);
-    auto lefts  = findByVote(strokes, BOX_LEFT);
-    auto rights = findByVote(strokes, BOX_RIGHT);
-    auto bots   = findByVote(strokes, BOX_BOTTOM);
+    const vector<size_t>& tops   = search.tops;
+    const vector<size_t>& lefts  = search.lefts;
+    const vector<size_t>& rights = search.rights;
+    const vector<size_t>& bots   = search.bots;
+    const vector<bool>& alive = search.alive;
+
+    // at most the cheapest each stroke can be joined to its neighbours
+    vector<double>& minTL = search.minTL;
+    vector<double>& minRT = search.minRT;
+    vector<double>& minLB = search.minLB;
+    vector<double>& minBR = search.minBR;
+    double minLBAll = JOIN_CACHE_REACH;
+    double minBRAll = JOIN_CACHE_REACH;
+    for (size_t t : tops) {
+        minTL[t] = search.TL.nearestInRow(t, alive);
+        minRT[t] = search.RT.nearestInColumn(t, alive);
+    }
+    for (size_t l : lefts) {
+        minLB[l] = search.LB.nearestInRow(l, alive);
+        if (alive[l]) {
+            minLBAll = min(minLBAll, minLB[l]);
+        }
+    }
+    for (size_t r : rights) {
+        minBR[r] = search.BR.nearestInColumn(r, alive);
+        if (alive[r]) {
+            minBRAll = min(minBRAll, minBR[r]);
+        }
+    }
+
+    // Seed the bound with a likely box: each top's nearest left and right
+    // sides and the bottom that best joins them.
+    double bound = numeric_limits<double>::infinity();
+    for (size_t t : tops) {
+        size_t l, r;
+        if (alive[t] &&
+                search.TL.nearestInRow(t, alive, &l) < JOIN_CACHE_REACH &&
+                search.RT.nearestInColumn(t, alive, &r) < JOIN_CACHE_REACH) {
+            for (auto& lb : search.LB.row(l)) {
+                size_t b = lb.first;
+                if (alive[b]) {
+                    bound = min(bound, search.TL.get(t, l) + lb.second + search.BR.get(b, r) + search.RT.get(r, t));
+                }
+            }
+        }
+    }
 
+    // Search in the same order as trying every combination would, so that
+    // ties go to the same box, but skip branches that can't beat the bound
+    // (the seed, or the best box so far).
     bool first = true;
     double bestScore;
-    VotedStroke bestTop, bestLeft, bestRight, bestBot;
-
-    for (auto& top : tops) {
-        for (auto& left : lefts) {
-            for (auto& right : rights) {
-                for (auto& bot : bots) {
-                    double score = scoreBox(top, left, right, bot);
+    size_t bestT = 0, bestL = 0, bestR = 0, bestB = 0;
+    auto hopeless = [&](double cost) {
+        return cost > bound + BOUND_SLACK;
+    };
+
+    for (size_t t : tops) {
+        if (!alive[t] || hopeless(minTL[t] + minRT[t] + minLBAll + minBRAll)) {
+            continue;
+        }
+        for (size_t l : lefts) {
+            if (!alive[l]) {
+                continue;
+            }
+            double tl = search.TL.get(t, l);
+            if (hopeless(tl + minRT[t] + minLB[l] + minBRAll)) {
+                continue;
+            }
+            for (size_t r : rights) {
+                if (!alive[r]) {
+                    continue;
+                }
+                double rt = search.RT.get(r, t);
+                if (hopeless(tl + rt + minLB[l] + minBR[r])) {
+                    continue;
+                }
+                auto consider = [&](size_t b, double lb) {
+                    double score = -(tl + lb + search.BR.get(b, r) + rt);
                     if (first || score > bestScore) {
                         first = false;
                         bestScore = score;
-                        bestTop = top;
-                        bestLeft = left;
-                        bestRight = right;
-                        bestBot = bot;
+                        bestT = t;
+                        bestL = l;
+                        bestR = r;
+                        bestB = b;
+                        bound = min(bound, -score);
+                    }
+                };
+                // A bottom that isn't cached beside l is at least
+                // JOIN_CACHE_REACH from it. If that can't win, only the cached
+                // ones are tried; they are in index order like bots, so ties
+                // still go to the same box.
+                if (hopeless(tl + rt + JOIN_CACHE_REACH + minBR[r])) {
+                    for (auto& lb : search.LB.row(l)) {
+                        if (alive[lb.first]) {
+                            consider(lb.first, lb.second);
+                        }
+                    }
+                    continue;
+                }
+                for (size_t b : bots) {
+                    if (alive[b]) {
+                        consider(b, search.LB.get(l, b));
                     }
                 }
             }
@@ -103,31 +374,107 @@ LayoutObject* findBestBox(vector<VotedStroke>& strokes) {
     }
 
     if (first) {
-        cerr << "failed to find box" << endl;
+        log << "failed to find box" << endl;
     } else {
+        const vector<VotedStroke>& strokes = search.strokes;
         int* rect = obj.data.boxData;
-        rect[0] = midpoint(bestLeft.stroke.line)[0];
-        rect[1] = midpoint(bestTop.stroke.line)[1];
-        rect[2] = midpoint(bestRight.stroke.line)[0] - rect[0];
-        rect[3] = midpoint(bestBot.stroke.line)[1] - rect[1];
-
-        strokes.erase(find(strokes.begin(), strokes.end(), bestTop));
-        strokes.erase(find(strokes.begin(), strokes.end(), bestLeft));
-        strokes.erase(find(strokes.begin(), strokes.end(), bestRight));
-        strokes.erase(find(strokes.begin(), strokes.end(), bestBot));
+        rect[0] = midpoint(strokes[bestL].stroke.line)[0];
+        rect[1] = midpoint(strokes[bestT].stroke.line)[1];
+        rect[2] = midpoint(strokes[bestR].stroke.line)[0] - rect[0];
+        rect[3] = midpoint(strokes[bestB].stroke.line)[1] - rect[1];
+
+        search.kill(bestT);
+        search.kill(bestL);
+        search.kill(bestR);
+        search.kill(bestB);
     }
 
     return new LayoutObject(obj);
 }
 
-void considerTarget(const LayoutObject* o, const Vec2i& pt, const Vec4i& line, MeasurementRel lineRel, const LayoutObject* &best, MeasurementRel& rel, double& bestScore) {
-    double score = closestApproach(pt, line);
-    if (best == nullptr || score < bestScore) {
-        bestScore = score;
-        best = o;
-        rel = lineRel;
+/**
+ * The borders of every box, with the horizontal ones sorted by y and the
+ * vertical ones by x, to find the border nearest a point without measuring
+ * the distance to all of them.
+ */
+class BorderIndex {
+public:
+    BorderIndex(const vector<LayoutObject*>& objs) {
+        for (auto o : objs) {
+            if (o->type == LAYOUT_BOX) {
+                add(horizontal, o, TOP_BORDER,    1);
+                add(horizontal, o, BOTTOM_BORDER, 1);
+                add(vertical,   o, LEFT_BORDER,   0);
+                add(vertical,   o, RIGHT_BORDER,  0);
+            }
+        }
+        auto byPos = [](const Border& b1, const Border& b2) { return b1.pos < b2.pos; };
+        stable_sort(horizontal.begin(), horizontal.end(), byPos);
+        stable_sort(vertical.begin(), vertical.end(), byPos);
     }
-}
+
+    // The top or bottom border nearest `pt`. Ties go to the earlier box, and
+    // to a box's top border over its bottom one.
+    bool nearestHorizontal(const Vec2i& pt, const LayoutObject*& box, MeasurementRel& rel) const {
+        return nearest(horizontal, pt, pt[1], box, rel);
+    }
+
+    // the same for left and right borders
+    bool nearestVertical(const Vec2i& pt, const LayoutObject*& box, MeasurementRel& rel) const {
+        return nearest(vertical, pt, pt[0], box, rel);
+    }
+
+private:
+    struct Border {
+        int pos; // y of a horizontal border, x of a vertical one
+        size_t order;
+        const LayoutObject* box;
+        MeasurementRel rel;
+        Vec4i line;
+    };
+
+    static void add(vector<Border>& borders, const LayoutObject* o, MeasurementRel rel, int axis) {
+        Vec4i line = getLine(o, rel);
+        borders.push_back(Border { line[axis], borders.size(), o, rel, line });
+    }
+
+    // Visits borders from the nearest `pos` outward. A border is at least
+    // as far from `pt` as its line is, so the search stops at the first one
+    // whose line is farther than the best border so far.
+    static bool nearest(const vector<Border>& borders, const Vec2i& pt, int pos, const LayoutObject*& box, MeasurementRel& rel) {
+        auto below = lower_bound(borders.begin(), borders.end(), pos,
+                [](const Border& b, int pos) { return b.pos < pos; });
+        auto above = below;
+
+        const Border* best = nullptr;
+        double bestScore;
+        while (below != borders.begin() || above != borders.end()) {
+            const Border* next;
+            if (above != borders.end() && (below == borders.begin() ||
+                    (double)above->pos - pos <= (double)pos - (below - 1)->pos)) {
+                next = &*above++;
+            } else {
+                next = &*--below;
+            }
+            if (best != nullptr && abs((double)next->pos - pos) > bestScore) {
+                break;
+            }
+            double score = closestApproach(pt, next->line);
+            if (best == nullptr || score < bestScore || (score == bestScore && next->order < best->order)) {
+                bestScore = score;
+                best = next;
+            }
+        }
+
+        if (best != nullptr) {
+            box = best->box;
+            rel = best->rel;
+        }
+        return best != nullptr;
+    }
+
+    vector<Border> horizontal, vertical;
+};
 
 const char* printRel(MeasurementRel rel) {
     switch (rel) {
@@ -138,46 +485,34 @@ const char* printRel(MeasurementRel rel) {
     }
 }
 
-bool findTopTarget(const VotedStroke& s, const vector<LayoutObject*>& objs, LayoutObject& line) {
+bool findTopTarget(const VotedStroke& s, const BorderIndex& borders, LayoutObject& line, ostream& log) {
     auto l = orientTB(s.stroke.line);
     auto pt = Vec2i(l[0], l[1]);
 
     const LayoutObject* best = nullptr;
     MeasurementRel rel;
-    double bestScore;
-    for (auto o : objs) {
-        if (o->type == LAYOUT_BOX) {
-            considerTarget(o, pt, getLine(o, TOP_BORDER),    TOP_BORDER,    best, rel, bestScore);
-            considerTarget(o, pt, getLine(o, BOTTOM_BORDER), BOTTOM_BORDER, best, rel, bestScore);
-        }
-    }
+    borders.nearestHorizontal(pt, best, rel);
 
     line.data.measurementData.box1 = best;
     line.data.measurementData.rel1 = rel;
 
     if (best != nullptr) {
-        cerr << "top: " << l << " --> " << best->data.boxData[0] << ", " << best->data.boxData[1] << ", " << best->data.boxData[2] << ", " << best->data.boxData[3] << "(" << printRel(rel) << ")" << endl;
+        log << "top: " << l << " --> " << best->data.boxData[0] << ", " << best->data.boxData[1] << ", " << best->data.boxData[2] << ", " << best->data.boxData[3] << "(" << printRel(rel) << ")" << endl;
     }
 
     return best != nullptr;
 }
 
-bool findBottomTarget(const VotedStroke& s, const vector<LayoutObject*>& objs, LayoutObject& line) {
+bool findBottomTarget(const VotedStroke& s, const BorderIndex& borders, LayoutObject& line, ostream& log) {
     auto l = orientTB(s.stroke.line);
     auto pt = Vec2i(l[2], l[3]);
 
     const LayoutObject* best = nullptr;
     MeasurementRel rel;
-    double bestScore;
-    for (auto o : objs) {
-        if (o->type == LAYOUT_BOX) {
-            considerTarget(o, pt, getLine(o, TOP_BORDER),    TOP_BORDER,    best, rel, bestScore);
-            considerTarget(o, pt, getLine(o, BOTTOM_BORDER), BOTTOM_BORDER, best, rel, bestScore);
-        }
-    }
+    borders.nearestHorizontal(pt, best, rel);
 
     if (best != nullptr) {
-        cerr << "bot: " << l << " --> " << best->data.boxData[0] << ", " << best->data.boxData[1] << ", " << best->data.boxData[2] << ", " << best->data.boxData[3] << "(" << printRel(rel) << ")" << endl;
+        log << "bot: " << l << " --> " << best->data.boxData[0] << ", " << best->data.boxData[1] << ", " << best->data.boxData[2] << ", " << best->data.boxData[3] << "(" << printRel(rel) << ")" << endl;
     }
 
     line.data.measurementData.box2 = best;
@@ -186,19 +521,13 @@ bool findBottomTarget(const VotedStroke& s, const vector<LayoutObject*>& objs, L
     return best != nullptr;
 }
 
-bool findLeftTarget(const VotedStroke& s, const vector<LayoutObject*>& objs, LayoutObject& line) {
+bool findLeftTarget(const VotedStroke& s, const BorderIndex& borders, LayoutObject& line) {
     auto l = orientLR(s.stroke.line);
     auto pt = Vec2i(l[0], l[1]);
 
     const LayoutObject* best = nullptr;
     MeasurementRel rel;
-    double bestScore;
-    for (auto o : objs) {
-        if (o->type == LAYOUT_BOX) {
-            considerTarget(o, pt, getLine(o, LEFT_BORDER),  LEFT_BORDER,  best, rel, bestScore);
-            considerTarget(o, pt, getLine(o, RIGHT_BORDER), RIGHT_BORDER, best, rel, bestScore);
-        }
-    }
+    borders.nearestVertical(pt, best, rel);
 
     line.data.measurementData.box1 = best;
     line.data.measurementData.rel1 = rel;
@@ -206,19 +535,13 @@ bool findLeftTarget(const VotedStroke& s, const vector<LayoutObject*>& objs, Lay
     return best != nullptr;
 }
 
-bool findRightTarget(const VotedStroke& s, const vector<LayoutObject*>& objs, LayoutObject& line) {
+bool findRightTarget(const VotedStroke& s, const BorderIndex& borders, LayoutObject& line) {
     auto l = orientLR(s.stroke.line);
     auto pt = Vec2i(l[2], l[3]);
 
     const LayoutObject* best = nullptr;
     MeasurementRel rel;
-    double bestScore;
-    for (auto o : objs) {
-        if (o->type == LAYOUT_BOX) {
-            considerTarget(o, pt, getLine(o, LEFT_BORDER),  LEFT_BORDER,  best, rel, bestScore);
-            considerTarget(o, pt, getLine(o, RIGHT_BORDER), RIGHT_BORDER, best, rel, bestScore);
-        }
-    }
+    borders.nearestVertical(pt, best, rel);
 
     line.data.measurementData.box2 = best;
     line.data.measurementData.rel2 = rel;
@@ -226,56 +549,98 @@ bool findRightTarget(const VotedStroke& s, const vector<LayoutObject*>& objs, La
     return best != nullptr;
 }
 
-bool layoutLine(const VotedStroke& s, const vector<LayoutObject*>& objs, LayoutObject& line) {
+bool layoutLine(const VotedStroke& s, const BorderIndex& borders, LayoutObject& line, ostream& log) {
     if (mostlyVertical(s.stroke.line)) {
-        return findTopTarget(s, objs, line) && findBottomTarget(s, objs, line);
+        return findTopTarget(s, borders, line, log) && findBottomTarget(s, borders, line, log);
     } else if (mostlyHorizontal(s.stroke.line)) {
-        return findLeftTarget(s, objs, line) && findRightTarget(s, objs, line);
+        return findLeftTarget(s, borders, line) && findRightTarget(s, borders, line);
     }
     return false;
 }
 
 const char* getLabel(const VotedStroke& s) {
-    for (auto& v : s.votes) {
-        if (v.type == TEXT) {
-            return v.label.text;
-        } else if (v.type == MEASUREMENT_LINE) {
-            return v.label.text;
-        }
-    }
-    return "";
+    return s.label != nullptr ? s.label->text : "";
 }
 
-vector<LayoutObject*> explain(vector<VotedStroke> strokes) {
-    vector<LayoutObject*> result;
-
+// Finds the boxes among `strokes`, and then the measurements between them,
+// logging to `log`.
+static void explainRegion(const vector<VotedStroke>& strokes, vector<LayoutObject*>& boxes, vector<LayoutObject*>& measurements, ostream& log) {
     int nboxes = estimateBoxCount(strokes);
-    cerr << "guessing there are " << nboxes << " boxes..." << endl;
+    log << "guessing there are " << nboxes << " boxes..." << endl;
+    BoxSearch search(strokes);
     for (int i = 0; i < nboxes; ++i) {
-        result.push_back(findBestBox(strokes));
+        boxes.push_back(findBestBox(search, log));
     }
 
-    auto it = strokes.begin();
+    unsigned long hits = 0, lookups = 0;
+    for (auto* cache : { &search.TL, &search.LB, &search.BR, &search.RT }) {
+        hits += cache->hits();
+        lookups += cache->hits() + cache->misses();
+    }
+    log << "box search: " << hits << " of " << lookups << " joins cached ("
+         << (lookups > 0 ? 100.0 * hits / lookups : 0.0) << "%)" << endl;
+
+    // measurements only ever point at boxes, and those are all found by now
+    BorderIndex borders(boxes);
     int nlines = 0;
     LayoutObject o;
     o.type = MEASUREMENT;
-    while (it != strokes.end()) {
-
-        const VotedStroke& s = *it;
-
-        if (hasVote(s, MEASUREMENT_LINE) && layoutLine(s, result, o)) {
+    for (size_t i = 0; i < strokes.size(); ++i) {
+        const VotedStroke& s = strokes[i];
+        if (search.alive[i] && hasVote(s, MEASUREMENT_LINE) && layoutLine(s, borders, o, log)) {
             o.data.measurementData.text = getLabel(s);
-            result.push_back(new LayoutObject(o));
-            it = strokes.erase(it);
+            measurements.push_back(new LayoutObject(o));
+            search.alive[i] = false;
             ++nlines;
-        } else {
-            ++it;
         }
+    }
+
+    log << "#lines = " << nlines << endl;
+}
 
+static bool strokesNear(const VotedStroke& s1, const VotedStroke& s2) {
+    return closestApproach(s1.stroke.line, s2.stroke.line) < REGION_GAP;
+}
+
+static Extent strokeExtent(const VotedStroke& s) {
+    const Vec4i& l = s.stroke.line;
+    return Extent {
+        (double)min(l[0], l[2]), (double)min(l[1], l[3]),
+        (double)max(l[0], l[2]), (double)max(l[1], l[3]) };
+}
+
+vector<LayoutObject*> explain(const vector<VotedStroke>& strokes, const ExplainOptions& options) {
+    vector<LayoutObject*> result;
+    if (!options.splitRegions) {
+        vector<LayoutObject*> measurements;
+        explainRegion(strokes, result, measurements, cerr);
+        result.insert(result.end(), measurements.begin(), measurements.end());
+        return result;
     }
 
-    cerr << "#lines = " << nlines << endl;
+    // the extra pixel of slack keeps the grid exact despite rounding
+    auto regions = groupSpatial(strokes, strokesNear, strokeExtent, REGION_GAP + 1, options.threads);
+    cerr << "explaining " << regions.size() << " regions" << endl;
+
+    // each region logs to its own buffer, printed in order once all are done
+    vector<vector<LayoutObject*>> boxes(regions.size());
+    vector<vector<LayoutObject*>> measurements(regions.size());
+    vector<ostringstream> logs(regions.size());
+    parallelFor(regions.size(), options.threads, [&](size_t i) {
+        explainRegion(regions[i], boxes[i], measurements[i], logs[i]);
+    });
+    for (auto& log : logs) {
+        cerr << log.str();
+    }
 
+    // all the boxes come before all the measurements, as they do without
+    // regions, and regions are in the order of their first strokes
+    for (auto& b : boxes) {
+        result.insert(result.end(), b.begin(), b.end());
+    }
+    for (auto& m : measurements) {
+        result.insert(result.end(), m.begin(), m.end());
+    }
     return result;
 }
 
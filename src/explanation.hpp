@@ -40,7 +40,24 @@ struct LayoutObject {
 
 };
 
-std::vector<LayoutObject*> explain(std::vector<VotedStroke> strokes);
+// Strokes this far apart or more are never part of the same box, or of a
+// measurement and the box it points at, when regions are split (see
+// ExplainOptions).
+static const double REGION_GAP = 50;
+
+struct ExplainOptions {
+    // Split the strokes into regions, where each stroke is closer than
+    // REGION_GAP to another one in its region, and explain each region on
+    // its own. Boxes and measurements never span two regions, so separate
+    // panels of a page can be explained in parallel.
+    bool splitRegions = false;
+
+    // With splitRegions, regions are explained on this many threads at
+    // once. 0 means one thread per core.
+    int threads = 0;
+};
+
+std::vector<LayoutObject*> explain(const std::vector<VotedStroke>& strokes, const ExplainOptions& options = ExplainOptions());
 cv::Mat displayObjects(const cv::Mat& bg, const std::vector<LayoutObject*>& objects);
 
 #endif
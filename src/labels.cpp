@@ -0,0 +1,208 @@
+#include "labels.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace cv;
+using namespace std;
+
+static const char* LABEL_CHARS = "0123456789px%";
+
+// Glyphs are scaled (keeping their aspect ratio) into a box this big
+// before they are compared.
+static const int GLYPH_WIDTH = 16;
+static const int GLYPH_HEIGHT = 24;
+
+// anything longer isn't a label
+static const size_t MAX_LABEL_GLYPHS = 8;
+
+// Pieces of ink whose columns overlap by more than this fraction of the
+// narrower one belong to the same glyph (like the parts of a '%').
+static const double SAME_GLYPH_OVERLAP = 0.5;
+
+typedef vector<float> Features;
+
+struct Template {
+    char c;
+    Features features;
+};
+
+// Scales ink (nonzero where there is ink) into the glyph box, centered, and
+// returns it with zero mean and unit length so that dot products are
+// correlations.
+static Features features(const Mat& ink) {
+    double s = min((double)GLYPH_WIDTH / ink.cols, (double)GLYPH_HEIGHT / ink.rows);
+    int w = max(1, (int)round(ink.cols * s));
+    int h = max(1, (int)round(ink.rows * s));
+    Mat scaled;
+    resize(ink, scaled, Size(w, h), 0, 0, INTER_AREA);
+
+    Features f(GLYPH_WIDTH * GLYPH_HEIGHT, 0.0f);
+    int x0 = (GLYPH_WIDTH - w) / 2;
+    int y0 = (GLYPH_HEIGHT - h) / 2;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            f[(y0 + y) * GLYPH_WIDTH + x0 + x] = scaled.at<uchar>(y, x) / 255.0f;
+        }
+    }
+
+    float mean = 0;
+    for (float v : f) {
+        mean += v;
+    }
+    mean /= f.size();
+    float length = 0;
+    for (float& v : f) {
+        v -= mean;
+        length += v * v;
+    }
+    length = sqrt(length);
+    if (length > 0) {
+        for (float& v : f) {
+            v /= length;
+        }
+    }
+    return f;
+}
+
+static Rect inkBounds(const Mat& ink) {
+    int x0 = ink.cols, y0 = ink.rows, x1 = -1, y1 = -1;
+    for (int y = 0; y < ink.rows; ++y) {
+        for (int x = 0; x < ink.cols; ++x) {
+            if (ink.at<uchar>(y, x)) {
+                x0 = min(x0, x); x1 = max(x1, x);
+                y0 = min(y0, y); y1 = max(y1, y);
+            }
+        }
+    }
+    return x1 < 0 ? Rect() : Rect(Point(x0, y0), Point(x1 + 1, y1 + 1));
+}
+
+static vector<Template> renderTemplates() {
+    const int fonts[] = {
+        FONT_HERSHEY_SIMPLEX, FONT_HERSHEY_PLAIN, FONT_HERSHEY_DUPLEX,
+        FONT_HERSHEY_COMPLEX, FONT_HERSHEY_SCRIPT_SIMPLEX };
+    const int thicknesses[] = { 1, 3 };
+
+    vector<Template> result;
+    for (int font : fonts) {
+        for (int thickness : thicknesses) {
+            for (const char* c = LABEL_CHARS; *c; ++c) {
+                Mat canvas(100, 100, CV_8UC1, Scalar(0));
+                putText(canvas, string(1, *c), Point(20, 70), font, 2.0, Scalar(255), thickness);
+                result.push_back(Template { *c, features(canvas(inkBounds(canvas))) });
+            }
+        }
+    }
+    return result;
+}
+
+static const vector<Template>& templates() {
+    static const vector<Template> all = renderTemplates();
+    return all;
+}
+
+static float correlation(const Features& a, const Features& b) {
+    float sum = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Picks the character `glyph` looks most like, or returns 0 if it doesn't
+// clearly look like one of them.
+static char classify(const Mat& glyph, const LabelThresholds& thresholds, float& score) {
+    Features f = features(glyph);
+    float best[256] = { 0 };
+    for (auto& t : templates()) {
+        best[(unsigned char)t.c] = max(best[(unsigned char)t.c], correlation(f, t.features));
+    }
+
+    char first = 0;
+    float firstScore = 0, secondScore = 0;
+    for (const char* c = LABEL_CHARS; *c; ++c) {
+        float s = best[(unsigned char)*c];
+        if (s > firstScore) {
+            secondScore = firstScore;
+            firstScore = s;
+            first = *c;
+        } else if (s > secondScore) {
+            secondScore = s;
+        }
+    }
+
+    score = firstScore;
+    return (firstScore >= thresholds.minScore && firstScore - secondScore >= thresholds.minMargin) ? first : 0;
+}
+
+bool looksLikeLabel(const char* text) {
+    size_t digits = 0;
+    while (isdigit((unsigned char)text[digits])) {
+        ++digits;
+    }
+    const char* unit = text + digits;
+    return digits > 0 && (*unit == '\0' || strcmp(unit, "px") == 0 || strcmp(unit, "%") == 0);
+}
+
+bool recognizeLabel(const Mat& crop, Point origin, TextBox& label, const LabelThresholds& thresholds) {
+    Mat ink;
+    threshold(crop, ink, 230, 255, CV_THRESH_BINARY_INV);
+    Mat scratch = ink.clone(); // findContours draws on its input
+    vector<vector<Point>> contours;
+    findContours(scratch, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    if (contours.empty()) {
+        return false;
+    }
+
+    vector<Rect> glyphs;
+    for (auto& contour : contours) {
+        glyphs.push_back(boundingRect(contour));
+    }
+    sort(glyphs.begin(), glyphs.end(), [](const Rect& a, const Rect& b) { return a.x < b.x; });
+
+    vector<Rect> merged;
+    for (auto& g : glyphs) {
+        if (!merged.empty()) {
+            Rect& last = merged.back();
+            int overlap = min(last.x + last.width, g.x + g.width) - max(last.x, g.x);
+            if (overlap > SAME_GLYPH_OVERLAP * min(last.width, g.width)) {
+                last |= g;
+                continue;
+            }
+        }
+        merged.push_back(g);
+    }
+    if (merged.size() > MAX_LABEL_GLYPHS) {
+        return false;
+    }
+
+    string text;
+    float worst = 1;
+    Rect bounds = merged[0];
+    for (auto& g : merged) {
+        float score;
+        char c = classify(ink(g), thresholds, score);
+        if (c == 0) {
+            return false;
+        }
+        text += c;
+        worst = min(worst, score);
+        bounds |= g;
+    }
+    if (!looksLikeLabel(text.c_str())) {
+        return false;
+    }
+
+    char* copy = new char[text.size() + 1];
+    strcpy(copy, text.c_str());
+    label = TextBox {
+        Rect(bounds.tl() + origin, bounds.size()),
+        copy,
+        (int)round(worst * 100) };
+    return true;
+}
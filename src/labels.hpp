@@ -0,0 +1,33 @@
+#ifndef LABELS_H
+#define LABELS_H 1
+
+#include <opencv2/core/core.hpp>
+
+#include "ocr.hpp"
+
+/** whether `text` reads like a measurement label: digits, then "px" or "%" or nothing */
+bool looksLikeLabel(const char* text);
+
+/**
+ * How sure recognizeLabel must be of each glyph: how well (as a
+ * correlation) it must match its best character, and by how much more than
+ * any other character. eval/bench-labels compares settings.
+ */
+struct LabelThresholds {
+    float minScore = 0.6f;
+    float minMargin = 0.08f;
+};
+
+/**
+ * A small recognizer for measurement labels like "120px", "50%" or "8".
+ * Each glyph in `crop` (a piece of an unprocessed page whose top-left corner
+ * is `origin`) is compared with those characters rendered in OpenCV's
+ * Hershey fonts, which takes far less time than Tesseract.
+ *
+ * Returns true and fills in `label` only when every glyph matches one
+ * character clearly better than any other and the result looks like a
+ * label; otherwise it is unsure and the crop should go to Tesseract.
+ */
+bool recognizeLabel(const cv::Mat& crop, cv::Point origin, TextBox& label, const LabelThresholds& thresholds = LabelThresholds());
+
+#endif
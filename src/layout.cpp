@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <algorithm>
+#include <unordered_map>
 // #include <z3++.h>
 
 #include "UnionFind.hpp"
@@ -56,46 +57,41 @@ static int indexOf(const vector<T>& vec, const T& val) {
     return (it == vec.end()) ? -1 : (it - vec.begin());
 }
 
-// o1 contains o2?
-static bool forcedContainment(const LayoutObject* o1, const LayoutObject* o2,
-    const vector<Constraint>& constraints) {
-
-    for (auto& c : constraints) {
-        if (c.type == CONSTRAINT_CONTAINS && o1 == c.obj1 && o2 == c.obj2) {
-            return true;
-        }
-    }
-    return false;
-}
-
-vector<vector<int>> findTrees(vector<int> g,
+// Groups the objects of g that contain one another, directly or through
+// other objects, whether those are in g or not.
+vector<vector<int>> findTrees(const vector<int>& g,
     const vector<LayoutObject*>& objects,
-    const vector<Constraint>& constraints) {
+    const ConstraintGraph& constraints) {
 
-    struct Related {
-        const vector<LayoutObject*>& objects;
-        const vector<Constraint>& constraints;
+    unordered_map<const LayoutObject*, size_t> position;
+    for (size_t i = 0; i < g.size(); ++i) {
+        position[objects[g[i]]] = i;
+    }
 
-        bool operator()(int i1, int i2) {
-            return forcedContainment(objects[i1], objects[i2], constraints) ||
-                forcedContainment(objects[i2], objects[i1], constraints);
+    UnionFind uf(g.size());
+    for (size_t i = 0; i < g.size(); ++i) {
+        for (auto o : constraints.containedIn(objects[g[i]])) {
+            auto it = position.find(o);
+            if (it != position.end()) {
+                uf.join(i, it->second);
+            }
         }
-    };
+    }
 
-    return group(g, Related { objects, constraints });
+    return collectGroups(g, uf);
 }
 
 // moves root to position 0
 static void findRoot(vector<int>& g,
     const vector<LayoutObject*>& objects,
-    const vector<Constraint>& constraints) {
+    const ConstraintGraph& constraints) {
 
     int rootIdx = 0;
     for (int i = 1; i < g.size(); ++i) {
         auto o1 = objects[g[rootIdx]];
         auto o2 = objects[g[i]];
 
-        if (forcedContainment(o2, o1, constraints)) {
+        if (constraints.contains(o2, o1)) {
             cerr << "woo@" << i << endl;
             rootIdx = i;
         }
@@ -106,38 +102,21 @@ static void findRoot(vector<int>& g,
     }
 }
 
-void applySizeConstraints(Element* e, const LayoutObject* o, const vector<Constraint>& constraints) {
-    for (auto& c : constraints) {
-        switch (c.type) {
-            case CONSTRAINT_WIDTH:
-                if (c.obj1 == o) { e->data.boxData.width = c.len; }
-                break;
-            case CONSTRAINT_HEIGHT:
-                if (c.obj1 == o) { e->data.boxData.height = c.len; }
-                break;
-            default:
-                break;
-        }
+void applySizeConstraints(Element* e, const LayoutObject* o, const ConstraintGraph& constraints) {
+    if (auto width = constraints.length(CONSTRAINT_WIDTH, o)) {
+        e->data.boxData.width = *width;
+    }
+    if (auto height = constraints.length(CONSTRAINT_HEIGHT, o)) {
+        e->data.boxData.height = *height;
     }
 }
 
-void applyMarginConstraints(const LayoutObject* parent, Element* e, const LayoutObject* o, const vector<Constraint>& constraints) {
-    for (auto& c : constraints) {
-        switch (c.type) {
-            case CONSTRAINT_PAD_TOP:
-                if (c.obj1 == parent && c.obj2 == o) { e->data.boxData.margin[0] = c.len; }
-                break;
-            case CONSTRAINT_PAD_RIGHT:
-                if (c.obj1 == parent && c.obj2 == o) { e->data.boxData.margin[1] = c.len; }
-                break;
-            case CONSTRAINT_PAD_BOTTOM:
-                if (c.obj1 == parent && c.obj2 == o) { e->data.boxData.margin[2] = c.len; }
-                break;
-            case CONSTRAINT_PAD_LEFT:
-                if (c.obj1 == parent && c.obj2 == o) { e->data.boxData.margin[3] = c.len; }
-                break;
-            default:
-                break;
+void applyMarginConstraints(const LayoutObject* parent, Element* e, const LayoutObject* o, const ConstraintGraph& constraints) {
+    // top, right, bottom, left, like margin
+    const ConstraintType pads[] = { CONSTRAINT_PAD_TOP, CONSTRAINT_PAD_RIGHT, CONSTRAINT_PAD_BOTTOM, CONSTRAINT_PAD_LEFT };
+    for (int i = 0; i < 4; ++i) {
+        if (auto pad = constraints.length(pads[i], parent, o)) {
+            e->data.boxData.margin[i] = *pad;
         }
     }
 }
@@ -145,7 +124,7 @@ void applyMarginConstraints(const LayoutObject* parent, Element* e, const Layout
 Element* buildLayout(
     const vector<int>& g,
     const vector<LayoutObject*>& objects,
-    const vector<Constraint>& constraints,
+    const ConstraintGraph& constraints,
     const LayoutObject* parent = nullptr) {
 
     if (g.size() == 0) {
@@ -209,6 +188,13 @@ Layout toLayout(
     const vector<LayoutObject*>& objects,
     const vector<Constraint>& constraints) {
 
+    return toLayout(objects, ConstraintGraph(constraints));
+}
+
+Layout toLayout(
+    const vector<LayoutObject*>& objects,
+    const ConstraintGraph& constraints) {
+
     // context ctx;
     // solver s(ctx);
 
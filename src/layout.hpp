@@ -17,6 +17,10 @@ Layout toLayout(
     const std::vector<LayoutObject*>& objects,
     const std::vector<Constraint>& constraints);
 
+Layout toLayout(
+    const std::vector<LayoutObject*>& objects,
+    const ConstraintGraph& constraints);
+
 std::ostream& operator<<(std::ostream& stream, const Layout& layout);
 
 #endif
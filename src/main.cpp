@@ -1,14 +1,20 @@
 #include <iostream>
+#include <cstdlib>
 #include <cstring>
+#include <future>
+#include <memory>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "segments.hpp"
 #include "strokes.hpp"
 #include "ocr.hpp"
+#include "ocrcache.hpp"
 #include "voting.hpp"
+#include "explanation.hpp"
 #include "constraints.hpp"
 #include "layout.hpp"
+#include "util.hpp"
 
 using namespace std;
 using namespace cv;
@@ -19,26 +25,87 @@ static void show(const char* title, const Mat& m) {
     imshow(title, scaled);
 }
 
+// Runs one stage of the pipeline and logs when it started and finished,
+// relative to `t0`, so overlapping stages are easy to see.
+template <class F>
+static auto stage(const char* name, Clock::time_point t0, F f) -> decltype(f()) {
+    double started = millisSince(t0);
+    auto result = f();
+    cerr << "stage " << name << ": " << started << " - " << millisSince(t0) << " ms" << endl;
+    return result;
+}
+
+// Like stage, but on a thread of its own.
+template <class F>
+static auto stageAsync(const char* name, Clock::time_point t0, F f) -> future<decltype(f())> {
+    return async(launch::async, [=]() { return stage(name, t0, f); });
+}
+
 static int usage(char** argv) {
-    cerr << "Usage: " << argv[0] << " [--no-debug] <file>" << endl;
+    cerr << "Usage: " << argv[0] << " [--no-debug] [--segments=hough|tiled|pyramid|runs] [--ocr-per-word] [--ocr-threads=N] [--ocr-crops|--ocr-labels|--ocr-roi] [--ocr-cache=DIR [--ocr-cache-mb=N]] [--explain-regions] [--full-containment] <file>" << endl;
     return 1;
 }
 
 int main(int argc, char** argv) {
 
-    if (argc < 2 || argc > 3) {
+    if (argc < 2) {
         return usage(argv);
     }
 
     bool interactive = true;
-    if (argc == 3) {
-        if (strcmp(argv[1], "--no-debug") == 0) {
+    SegmentEngine segmentEngine = SEGMENTS_HOUGH;
+    OcrOptions ocrOptions;
+    bool ocrNearStrokes = false;
+    const char* ocrCacheDir = nullptr;
+    size_t ocrCacheBytes = OcrCache::DEFAULT_MAX_BYTES;
+    bool ocrCacheSized = false;
+    ExplainOptions explainOptions;
+    ConstraintOptions constraintOptions;
+    for (int i = 1; i < argc - 1; ++i) {
+        if (strcmp(argv[i], "--no-debug") == 0) {
             interactive = false;
+        } else if (strcmp(argv[i], "--ocr-per-word") == 0) {
+            ocrOptions.mode = OCR_PER_WORD;
+        } else if (strncmp(argv[i], "--ocr-threads=", 14) == 0) {
+            ocrOptions.threads = atoi(argv[i] + 14);
+        } else if (strcmp(argv[i], "--ocr-crops") == 0) {
+            ocrOptions.upscaling = UPSCALE_TEXT_CROPS;
+        } else if (strcmp(argv[i], "--ocr-labels") == 0) {
+            ocrOptions.upscaling = UPSCALE_TEXT_CROPS;
+            ocrOptions.fastLabels = true;
+        } else if (strcmp(argv[i], "--ocr-roi") == 0) {
+            ocrNearStrokes = true;
+        } else if (strncmp(argv[i], "--ocr-cache=", 12) == 0) {
+            ocrCacheDir = argv[i] + 12;
+        } else if (strncmp(argv[i], "--ocr-cache-mb=", 15) == 0) {
+            ocrCacheBytes = (size_t)atoi(argv[i] + 15) * 1024 * 1024;
+            ocrCacheSized = true;
+        } else if (strcmp(argv[i], "--explain-regions") == 0) {
+            explainOptions.splitRegions = true;
+        } else if (strcmp(argv[i], "--full-containment") == 0) {
+            constraintOptions.fullContainment = true;
+        } else if (strncmp(argv[i], "--segments=", 11) == 0) {
+            if (!parseSegmentEngine(argv[i] + 11, segmentEngine)) {
+                return usage(argv);
+            }
         } else {
             return usage(argv);
         }
     }
 
+    // findTextNearStrokes always upscales its crops whole and never reads
+    // labels, and a cache size means nothing without a cache, so these
+    // would be silently ignored
+    if ((ocrNearStrokes && ocrOptions.upscaling == UPSCALE_TEXT_CROPS) || (ocrCacheSized && ocrCacheDir == nullptr)) {
+        return usage(argv);
+    }
+
+    unique_ptr<OcrCache> ocrCache;
+    if (ocrCacheDir != nullptr) {
+        ocrCache.reset(new OcrCache(ocrCacheDir, ocrCacheBytes));
+        ocrOptions.cache = ocrCache.get();
+    }
+
     const char* file = argv[argc-1];
 
     Mat input = imread(file, CV_LOAD_IMAGE_GRAYSCALE);
@@ -48,13 +115,26 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    auto segments    = findSegments(input);
-    auto strokes     = findStrokes(segments);
-    auto ocr         = findText(input);
-    auto votes       = placeVotes(strokes, ocr);
-    auto objects     = explain(votes);
-    auto constraints = formConstraints(objects);
-    auto layout      = toLayout(objects, constraints);
+    // OCR only needs the input, so it runs alongside the line stages, unless
+    // it is looking near strokes or reading labels beside them and has to
+    // wait for them.
+    auto t0 = Clock::now();
+    const bool ocrNeedsStrokes = ocrNearStrokes || ocrOptions.fastLabels;
+    future<vector<TextBox>> text;
+    if (!ocrNeedsStrokes) {
+        text = stageAsync("ocr", t0, [&]() { return findText(input, ocrOptions); });
+    }
+    auto segments    = stage("segments", t0, [&]() { return findSegments(input, segmentEngine); });
+    auto strokes     = stage("strokes",  t0, [&]() { return findStrokes(segments); });
+    auto ocr         = ocrNearStrokes ?
+        stage("ocr", t0, [&]() { return findTextNearStrokes(input, strokes, ocrOptions); }) :
+        ocrNeedsStrokes ?
+        stage("ocr", t0, [&]() { return findText(input, strokes, ocrOptions); }) :
+        text.get();
+    auto votes       = stage("votes",       t0, [&]() { return placeVotes(strokes, ocr); });
+    auto objects     = stage("explain",     t0, [&]() { return explain(votes, explainOptions); });
+    auto constraints = stage("constraints", t0, [&]() { return formConstraints(objects, constraintOptions); });
+    auto layout      = stage("layout",      t0, [&]() { return toLayout(objects, constraints); });
 
     cout << layout << endl;
 
@@ -1,8 +1,19 @@
 #include "ocr.hpp"
+#include "ocrcache.hpp"
+#include "geometry.hpp"
+#include "labels.hpp"
+#include "parallel.hpp"
+#include "UnionFind.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <sys/stat.h>
 #include <baseapi.h>     // Tesseract
+#include <resultiterator.h>
 #include <allheaders.h>  // Leptonica
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -19,58 +30,704 @@ void dilate(Mat& img, int size) {
     erode(img, img, element);
 }
 
-vector<TextBox> findText(const Mat& img) {
-    const double UPSCALE = 3.0;
+OcrEnginePool::OcrEnginePool(int capacity, const char* language)
+    : capacity(capacity), language(language), initializing(0), totalInitMillis(0) { }
 
-    Mat pp; // preprocessed
-    resize(img, pp, Size(0, 0), UPSCALE, UPSCALE, INTER_CUBIC);
-    dilate(pp, 1);
-    threshold(pp, pp, 230, 255, CV_THRESH_BINARY);
+OcrEnginePool::~OcrEnginePool() {
+    for (auto engine : all) {
+        engine->End();
+        delete engine;
+    }
+}
 
-    tesseract::TessBaseAPI ocr;
+tesseract::TessBaseAPI* OcrEnginePool::acquire(bool* reused) {
+    {
+        unique_lock<mutex> guard(lock);
+        while (idle.empty() && (int)all.size() + initializing >= capacity) {
+            returned.wait(guard);
+        }
+        if (!idle.empty()) {
+            auto engine = idle.back();
+            idle.pop_back();
+            if (reused != nullptr) {
+                *reused = true;
+            }
+            return engine;
+        }
+        ++initializing;
+    }
 
-    if (ocr.Init(NULL, "eng" /*, tesseract::OEM_TESSERACT_CUBE_COMBINED */)) {
+    // initialize outside the lock; it takes a while
+    auto start = Clock::now();
+    auto engine = new tesseract::TessBaseAPI;
+    if (engine->Init(NULL, language /*, tesseract::OEM_TESSERACT_CUBE_COMBINED */)) {
         cerr << "Could not initialize tesseract." << endl;
         exit(1);
     }
+    double ms = millisSince(start);
 
-    // Mat scldown;
-    // resize(pp, scldown, Size(0, 0), .25, .25, INTER_CUBIC);
-    // imshow("text preprocessing", scldown);
+    {
+        lock_guard<mutex> guard(lock);
+        --initializing;
+        all.push_back(engine);
+        totalInitMillis += ms;
+    }
+    if (reused != nullptr) {
+        *reused = false;
+    }
+    return engine;
+}
 
-    vector<TextBox> result;
+void OcrEnginePool::release(tesseract::TessBaseAPI* engine) {
+    // drop the image, rectangle and recognition results, and anything the
+    // engine adapted to, so the next user sees a freshly initialized engine
+    engine->Clear();
+    engine->ClearAdaptiveClassifier();
+    engine->SetPageSegMode(tesseract::PSM_SINGLE_BLOCK);
+
+    {
+        lock_guard<mutex> guard(lock);
+        idle.push_back(engine);
+    }
+    returned.notify_one();
+}
+
+double OcrEnginePool::initMillis() {
+    lock_guard<mutex> guard(lock);
+    return all.empty() ? 0.0 : totalInitMillis / all.size();
+}
+
+OcrEnginePool& OcrEnginePool::shared() {
+    static OcrEnginePool pool(defaultThreadCount());
+    return pool;
+}
+
+// Records a word found at (x, y, w, h) in a preprocessed image upscaled by
+// `upscale`, or in a crop of one whose top-left corner is `origin`.
+static void addTextBox(vector<TextBox>& result, int x, int y, int w, int h, Point origin, double upscale, const char* text, int conf) {
+    x = round((origin.x + x)/upscale);
+    y = round((origin.y + y)/upscale);
+    w = round(w/upscale);
+    h = round(h/upscale);
+    result.push_back(TextBox {
+        Rect(Point(x, y), Size(w, h)),
+        text,
+        conf });
+}
+
+// Recognizes the whole image once and reads every word back from the
+// result iterator.
+static void recognizeSinglePass(tesseract::TessBaseAPI* ocr, Point origin, double upscale, vector<TextBox>& result) {
+    if (ocr->Recognize(NULL) != 0) {
+        cerr << "text recognition failed" << endl;
+        return;
+    }
+    unique_ptr<tesseract::ResultIterator> it(ocr->GetIterator());
+    if (it == nullptr) {
+        return;
+    }
+
+    const auto level = tesseract::RIL_WORD;
+    do {
+        int left, top, right, bottom;
+        if (it->Empty(level) || !it->BoundingBox(level, &left, &top, &right, &bottom)) {
+            continue;
+        }
+        const char* text = it->GetUTF8Text(level);
+        if (text == nullptr) {
+            continue;
+        }
+        int conf = it->Confidence(level);
+        if (*text != 0 && conf > 0) {
+            addTextBox(result, left, top, right - left, bottom - top, origin, upscale, text, conf);
+        } else {
+            delete[] text;
+        }
+    } while (it->Next(level));
+}
 
-    ocr.SetPageSegMode(tesseract::PSM_SPARSE_TEXT);
-    // ocr.SetVariable("tessedit_char_whitelist", "0123456789px% .-");
-    ocr.SetImage(pp.data, pp.size().width, pp.size().height, pp.step[1], pp.step[0]);
-    Boxa* boxes = ocr.GetComponentImages(tesseract::RIL_WORD, true, NULL, NULL);
+// Finds the word boxes first, then recognizes each box separately. Slower,
+// since each word is recognized from scratch, but kept as a fallback.
+static void recognizePerWord(tesseract::TessBaseAPI* ocr, Point origin, double upscale, vector<TextBox>& result) {
+    Boxa* boxes = ocr->GetComponentImages(tesseract::RIL_WORD, true, NULL, NULL);
     if (boxes == nullptr) {
-        return result;
+        return;
     }
 
     for (int i = 0; i < boxes->n; i++) {
         BOX* box = boxaGetBox(boxes, i, L_CLONE);
-        ocr.SetRectangle(box->x, box->y, box->w, box->h);
-        const char* ocrResult = ocr.GetUTF8Text();
+        ocr->SetRectangle(box->x, box->y, box->w, box->h);
+        const char* ocrResult = ocr->GetUTF8Text();
         if (ocrResult == nullptr) {
             continue;
         }
-        int conf = ocr.MeanTextConf();
+        int conf = ocr->MeanTextConf();
         if (*ocrResult != 0 && conf > 0) {
-            int x = round(box->x/UPSCALE);
-            int y = round(box->y/UPSCALE);
-            int w = round(box->w/UPSCALE);
-            int h = round(box->h/UPSCALE);
-            cerr << "text box @" << x << ',' << y << ',' << w << ',' << h << "; conf=" << conf << "; text='" << ocrResult << '\'' << endl;
-            result.push_back(TextBox {
-                Rect(Point(x, y), Size(w, h)),
-                ocrResult });
+            addTextBox(result, box->x, box->y, box->w, box->h, origin, upscale, ocrResult, conf);
         } else {
             delete[] ocrResult;
         }
     }
     boxaDestroy(&boxes);
+}
+
+static const tesseract::PageSegMode PAGE_SEG_MODE = tesseract::PSM_SPARSE_TEXT;
+static const char* WHITELIST = nullptr; // e.g. "0123456789px% .-"
+
+static void setImage(tesseract::TessBaseAPI* ocr, const Mat& pp) {
+    ocr->SetPageSegMode(PAGE_SEG_MODE);
+    if (WHITELIST != nullptr) {
+        ocr->SetVariable("tessedit_char_whitelist", WHITELIST);
+    }
+    ocr->SetImage(pp.data, pp.size().width, pp.size().height, pp.step[1], pp.step[0]);
+}
+
+// Identifies the Tesseract build and the traineddata file `ocr` loaded, so
+// upgrading either one stops old cache entries from matching. All engines
+// in the pool load the same file, so this is only worked out once.
+static const string& modelIdentity(tesseract::TessBaseAPI* ocr) {
+    static const string identity = [ocr]() {
+        string file = string(ocr->GetDatapath()) + '/' + OcrEnginePool::shared().languageName() + ".traineddata";
+        string id = string("tesseract=") + tesseract::TessBaseAPI::Version() + "|model=" + file;
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0) {
+            id += "|size=" + to_string((long long)st.st_size) + "|mtime=" + to_string((long long)st.st_mtime);
+        }
+        return id;
+    }();
+    return identity;
+}
+
+// everything besides the pixels that decides what recognition finds
+static string cacheSettings(tesseract::TessBaseAPI* ocr, OcrMode mode) {
+    return string(OcrEnginePool::shared().languageName()) +
+        "|" + modelIdentity(ocr) +
+        "|psm=" + to_string((int)PAGE_SEG_MODE) +
+        "|whitelist=" + (WHITELIST != nullptr ? WHITELIST : "") +
+        "|mode=" + to_string((int)mode);
+}
+
+// Recognizes the text in `pp`, a preprocessed image or a crop of one whose
+// top-left corner is `origin`. With a cache, words found in the same
+// pixels before are read back instead.
+static void recognize(tesseract::TessBaseAPI* ocr, const OcrOptions& options, const Mat& pp, Point origin, double upscale, vector<TextBox>& result) {
+    if (options.cache == nullptr) {
+        setImage(ocr, pp);
+        switch (options.mode) {
+            case OCR_SINGLE_PASS: recognizeSinglePass(ocr, origin, upscale, result); break;
+            case OCR_PER_WORD:    recognizePerWord(ocr, origin, upscale, result);    break;
+        }
+        return;
+    }
+
+    uint64_t key = OcrCache::key(pp, cacheSettings(ocr, options.mode));
+    vector<TextBox> words; // in pp's own coordinates
+    if (!options.cache->lookup(key, words)) {
+        OcrOptions uncached = options;
+        uncached.cache = nullptr;
+        recognize(ocr, uncached, pp, Point(0, 0), 1.0, words);
+        options.cache->store(key, words);
+    }
+    for (auto& w : words) {
+        const Rect& r = w.boundary;
+        addTextBox(result, r.x, r.y, r.width, r.height, origin, upscale, w.text, w.confidence);
+    }
+}
+
+static void logCache(const OcrOptions& options) {
+    if (options.cache != nullptr) {
+        cerr << "ocr cache: " << options.cache->hits() << " hits, " << options.cache->misses() << " misses, "
+             << options.cache->bytes() << " bytes" << endl;
+    }
+}
+
+static void noteReuse(const OcrLease& ocr) {
+    if (ocr.reused()) {
+        cerr << "ocr: reused an initialized engine, saved ~" << OcrEnginePool::shared().initMillis() << " ms" << endl;
+    }
+}
+
+// Finds the lines of text on a preprocessed page with Tesseract's layout
+// analysis alone, which is much cheaper than recognizing them.
+static vector<Rect> findTextLines(const Mat& pp) {
+    OcrLease ocr(OcrEnginePool::shared());
+    noteReuse(ocr);
+    setImage(ocr.get(), pp);
+
+    vector<Rect> lines;
+    Boxa* boxes = ocr->GetComponentImages(tesseract::RIL_TEXTLINE, true, NULL, NULL);
+    if (boxes == nullptr) {
+        return lines;
+    }
+    for (int i = 0; i < boxes->n; i++) {
+        BOX* box = boxaGetBox(boxes, i, L_CLONE);
+        lines.push_back(Rect(box->x, box->y, box->w, box->h));
+        boxDestroy(&box);
+    }
+    boxaDestroy(&boxes);
+    return lines;
+}
+
+// Small handwriting is hard to read at its original size.
+static const double UPSCALE = 3.0;
+
+static void preprocess(const Mat& img, double scale, Mat& pp) {
+    resize(img, pp, Size(0, 0), scale, scale, INTER_CUBIC);
+    dilate(pp, 1);
+    threshold(pp, pp, 230, 255, CV_THRESH_BINARY);
+}
+
+// A piece of a page to recognize on its own, preprocessed at `upscale`.
+// `pp` holds its pixels, `origin` is where they sit in the whole page at
+// that scale, and only words whose centers fall inside `owned` (also page
+// coordinates at that scale) are kept. Where the owned rects of several
+// regions overlap, a word belongs to the first of them.
+struct OcrRegion {
+    Mat pp;
+    Point origin;
+    Rect owned;
+    double upscale;
+};
+
+static bool owns(const OcrRegion& region, const TextBox& word) {
+    Point center(
+        (word.boundary.x + word.boundary.width / 2.0) * region.upscale,
+        (word.boundary.y + word.boundary.height / 2.0) * region.upscale);
+    return region.owned.contains(center);
+}
+
+// Recognizes regions on `options.threads` threads, each with an engine of
+// its own, and appends the words in region order.
+static void recognizeRegions(const vector<OcrRegion>& regions, const OcrOptions& options, vector<TextBox>& result) {
+    vector<vector<TextBox>> found(regions.size());
+    vector<double> millis(regions.size());
+    atomic<size_t> next(0);
+    int nthreads = options.threads > 0 ? options.threads : defaultThreadCount();
+    nthreads = min<size_t>(nthreads, regions.size());
+
+    parallelFor(nthreads, nthreads, [&](size_t) {
+        OcrLease ocr(OcrEnginePool::shared());
+        noteReuse(ocr);
+        for (size_t r = next++; r < regions.size(); r = next++) {
+            const OcrRegion& region = regions[r];
+            auto start = Clock::now();
+            vector<TextBox> words;
+            recognize(ocr.get(), options, region.pp, region.origin, region.upscale, words);
+            for (auto& w : words) {
+                if (owns(region, w)) {
+                    found[r].push_back(w);
+                } else {
+                    delete[] w.text;
+                }
+            }
+            millis[r] = millisSince(start);
+        }
+    });
+
+    // text lines can overlap, so drop words an earlier region owns too
+    for (size_t r = 1; r < regions.size(); ++r) {
+        auto owned = [&](const TextBox& w) {
+            for (size_t q = 0; q < r; ++q) {
+                if (owns(regions[q], w)) {
+                    delete[] w.text;
+                    return true;
+                }
+            }
+            return false;
+        };
+        found[r].erase(remove_if(found[r].begin(), found[r].end(), owned), found[r].end());
+    }
+
+    for (size_t r = 0; r < regions.size(); ++r) {
+        const OcrRegion& region = regions[r];
+        cerr << "ocr: region " << r << " @" << region.owned.x / region.upscale << ',' << region.owned.y / region.upscale
+             << " x" << region.upscale << ": " << found[r].size() << " words in " << millis[r] << " ms" << endl;
+        result.insert(result.end(), found[r].begin(), found[r].end());
+    }
+}
+
+// Crops are padded this much (in preprocessed pixels) so glyphs on the edge
+// of a line aren't cut. The padding can pick up a neighbour's words, but
+// each word is only kept by the first line that holds its center.
+static const int LINE_PADDING = 10;
+
+static vector<OcrRegion> lineRegions(const Mat& pp) {
+    const Rect page(0, 0, pp.size().width, pp.size().height);
+    vector<OcrRegion> regions;
+    for (auto& line : findTextLines(pp)) {
+        Rect padded = Rect(
+            line.x - LINE_PADDING, line.y - LINE_PADDING,
+            line.width + 2*LINE_PADDING, line.height + 2*LINE_PADDING) & page;
+        regions.push_back(OcrRegion { pp(padded), padded.tl(), line, UPSCALE });
+    }
+    return regions;
+}
+
+static void logTextBoxes(const vector<TextBox>& boxes) {
+    for (auto& box : boxes) {
+        auto& r = box.boundary;
+        cerr << "text box @" << r.x << ',' << r.y << ',' << r.width << ',' << r.height << "; conf=" << box.confidence << "; text='" << box.text << '\'' << endl;
+    }
+}
+
+static Rect grow(const Rect& r, int dx, int dy) {
+    return Rect(r.x - dx, r.y - dy, r.width + 2*dx, r.height + 2*dy);
+}
+
+// Drops empty crops and merges overlapping ones, as long as the merged crop
+// is at most `maxGrowth` times bigger than the area the two covered. Crops
+// that still overlap afterwards recognize the same pixels twice, but each
+// word is only kept by one of them.
+static void mergeOverlapping(vector<Rect>& crops, double maxGrowth) {
+    crops.erase(remove_if(crops.begin(), crops.end(), [](const Rect& r) { return r.area() == 0; }), crops.end());
+
+    // Sweep the crops from left to right to find the overlapping pairs, and
+    // merge them through a union-find. Merged crops are bigger and can meet
+    // new ones, so repeat until a pass merges nothing.
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        vector<size_t> order(crops.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&crops](size_t i, size_t j) { return crops[i].x < crops[j].x; });
+
+        UnionFind uf(crops.size());
+        vector<Rect> bounds = crops; // of each set, by its root
+        vector<size_t> active;
+        for (size_t i : order) {
+            active.erase(remove_if(active.begin(), active.end(), [&](size_t j) { return crops[j].br().x <= crops[i].x; }), active.end());
+            for (size_t j : active) {
+                size_t a = uf.find(i), b = uf.find(j);
+                if (a == b || (crops[i] & crops[j]).area() == 0) {
+                    continue;
+                }
+                Rect both = bounds[a] | bounds[b];
+                double covered = bounds[a].area() + bounds[b].area() - (bounds[a] & bounds[b]).area();
+                if (both.area() <= maxGrowth * covered) {
+                    uf.join(a, b);
+                    bounds[uf.find(a)] = both;
+                    merged = true;
+                }
+            }
+            active.push_back(i);
+        }
+
+        // each merged crop takes the place of the first of its crops
+        vector<Rect> next;
+        vector<bool> done(crops.size(), false);
+        for (size_t i = 0; i < crops.size(); ++i) {
+            size_t root = uf.find(i);
+            if (!done[root]) {
+                done[root] = true;
+                next.push_back(bounds[root]);
+            }
+        }
+        crops.swap(next);
+    }
+}
+
+// Preprocesses each crop of img at its own scale. Scales must be whole
+// numbers so that crop origins land on whole pixels of the scaled page and
+// boxes round back to the same coordinates a full-page pass would give.
+static vector<OcrRegion> cropRegions(const Mat& img, const vector<Rect>& crops, const vector<int>& scales, int threads) {
+    vector<OcrRegion> regions(crops.size());
+    parallelFor(crops.size(), threads, [&](size_t i) {
+        const Rect& crop = crops[i];
+        OcrRegion& region = regions[i];
+        region.upscale = scales[i];
+        preprocess(img(crop), region.upscale, region.pp);
+        region.origin = Point(crop.x * scales[i], crop.y * scales[i]);
+        region.owned = Rect(region.origin, region.pp.size());
+    });
+
+    double covered = 0, preprocessed = 0;
+    for (auto& region : regions) {
+        covered += region.pp.total() / (region.upscale * region.upscale);
+        preprocessed += region.pp.total();
+    }
+    cerr << "ocr: " << crops.size() << " crops cover " << covered * 100 / img.total() << "% of the page, "
+         << preprocessed / (1024 * 1024) << " MB preprocessed" << endl;
+    return regions;
+}
+
+// Connected components this big might be glyphs; anything bigger (or much
+// wider than it is tall) is part of a drawing.
+static const int MIN_GLYPH_HEIGHT = 3;
+static const int MAX_GLYPH_HEIGHT = 100;
+static const int MAX_GLYPH_ASPECT = 4;
+
+// Crops are upscaled (by at most UPSCALE) until their typical glyph is this
+// tall, and padded by this much beforehand.
+static const int TARGET_GLYPH_HEIGHT = 30;
+static const int GLYPH_CROP_MARGIN = 5;
+
+// glyphs of one word or line are at most about a glyph height apart
+static bool sameText(const Rect& a, const Rect& b) {
+    int h = max(a.height, b.height);
+    return (grow(a, h, h / 2) & b).area() > 0;
+}
+
+static vector<Rect> glyphCrops(const Mat& img, vector<int>& scales) {
+    Mat ink;
+    threshold(img, ink, 230, 255, CV_THRESH_BINARY_INV);
+    // The outer boundary of every piece of ink, including pieces nested in
+    // the holes of others: text drawn inside a box sits in the hole of the
+    // box's outline. Holes are skipped, and the size filter drops outlines.
+    vector<vector<Point>> contours;
+    vector<Vec4i> hierarchy;
+    findContours(ink, contours, hierarchy, CV_RETR_CCOMP, CV_CHAIN_APPROX_SIMPLE);
+
+    vector<Rect> glyphs;
+    for (size_t i = 0; i < contours.size(); ++i) {
+        if (hierarchy[i][3] >= 0) {
+            continue; // a hole
+        }
+        Rect r = boundingRect(contours[i]);
+        if (r.height >= MIN_GLYPH_HEIGHT && r.height <= MAX_GLYPH_HEIGHT && r.width <= MAX_GLYPH_ASPECT * r.height) {
+            glyphs.push_back(r);
+        }
+    }
+
+    auto extentOf = [](const Rect& r) {
+        return Extent { (double)r.x, (double)r.y, (double)r.x + r.width, (double)r.y + r.height };
+    };
+    vector<Rect> crops;
+    for (auto& text : groupSpatial(glyphs, sameText, extentOf, MAX_GLYPH_HEIGHT + 1)) {
+        Rect bounds = text[0];
+        for (auto& g : text) {
+            bounds |= g;
+        }
+        crops.push_back(grow(bounds, GLYPH_CROP_MARGIN, GLYPH_CROP_MARGIN) & Rect(0, 0, img.size().width, img.size().height));
+    }
+    // overlapping glyph crops are pieces of one word or line, so keep it whole
+    mergeOverlapping(crops, numeric_limits<double>::infinity());
+
+    // scale each crop by its median glyph height
+    vector<vector<int>> heights(crops.size());
+    for (auto& g : glyphs) {
+        Point center(g.x + g.width / 2, g.y + g.height / 2);
+        for (size_t i = 0; i < crops.size(); ++i) {
+            if (crops[i].contains(center)) {
+                heights[i].push_back(g.height);
+                break;
+            }
+        }
+    }
+    scales.clear();
+    for (auto& h : heights) {
+        if (h.empty()) {
+            scales.push_back(UPSCALE);
+            continue;
+        }
+        nth_element(h.begin(), h.begin() + h.size() / 2, h.end());
+        int median = h[h.size() / 2];
+        scales.push_back(max(1, min((int)UPSCALE, (TARGET_GLYPH_HEIGHT + median - 1) / median)));
+    }
+    return crops;
+}
+
+// Strokes at least this long might be measurement lines; shorter ones are
+// probably pieces of handwriting.
+static const double MEASUREMENT_STROKE_MIN = 30;
+
+// roughly how big a label is, so a label whose near edge is in reach of a
+// measurement line isn't cut off
+static const int LABEL_SIZE = 60;
+
+// margin around clusters of short strokes, and how close their strokes are
+static const int HANDWRITING_MARGIN = 10;
+static const double HANDWRITING_GAP = 20;
+
+// Two long strokes, one mostly horizontal and one mostly vertical, whose
+// endpoints are this close make the corner of a box.
+static const double BOX_CORNER_GAP = 20;
+
+// Overlapping crops are merged if that grows them by at most this much.
+static const double CROP_MERGE_GROWTH = 1.25;
+
+static Rect strokeBounds(const Stroke& s) {
+    const Vec4i& l = s.line;
+    return Rect(Point(min(l[0], l[2]), min(l[1], l[3])), Point(max(l[0], l[2]) + 1, max(l[1], l[3]) + 1));
+}
+
+// Which of `strokes` are sides of boxes: long strokes with a corner at both
+// ends. Measurement lines end in the middle of a box's side, or on short
+// ticks, so they have no corners.
+static vector<bool> boxSides(const vector<Stroke>& strokes) {
+    struct End {
+        int x, y;
+        size_t stroke;
+    };
+    vector<End> ends;
+    for (size_t i = 0; i < strokes.size(); ++i) {
+        const Vec4i& l = strokes[i].line;
+        if (segmentLength(l) >= MEASUREMENT_STROKE_MIN) {
+            ends.push_back(End { l[0], l[1], i });
+            ends.push_back(End { l[2], l[3], i });
+        }
+    }
+    sort(ends.begin(), ends.end(), [](const End& a, const End& b) { return a.x < b.x; });
+
+    auto corner = [&](size_t i, int x, int y) {
+        auto it = lower_bound(ends.begin(), ends.end(), x - BOX_CORNER_GAP,
+                [](const End& e, double x) { return e.x < x; });
+        for (; it != ends.end() && it->x <= x + BOX_CORNER_GAP; ++it) {
+            double dx = it->x - x, dy = it->y - y;
+            if (dx*dx + dy*dy <= BOX_CORNER_GAP * BOX_CORNER_GAP &&
+                    mostlyHorizontal(strokes[it->stroke].line) != mostlyHorizontal(strokes[i].line)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    vector<bool> sides(strokes.size(), false);
+    for (size_t i = 0; i < strokes.size(); ++i) {
+        const Vec4i& l = strokes[i].line;
+        sides[i] = segmentLength(l) >= MEASUREMENT_STROKE_MIN && corner(i, l[0], l[1]) && corner(i, l[2], l[3]);
+    }
+    return sides;
+}
+
+// Long strokes that aren't sides of boxes: the ones that might be
+// measurement lines.
+static vector<size_t> measurementCandidates(const vector<Stroke>& strokes) {
+    const vector<bool> sides = boxSides(strokes);
+    vector<size_t> candidates;
+    for (size_t i = 0; i < strokes.size(); ++i) {
+        if (segmentLength(strokes[i].line) >= MEASUREMENT_STROKE_MIN && !sides[i]) {
+            candidates.push_back(i);
+        }
+    }
+    return candidates;
+}
+
+// Reads the crops within reach of a measurement line with the label
+// recognizer, and leaves the rest, and any it is unsure of, for Tesseract.
+// Text farther away never labels a line, so a quick guess there buys nothing.
+static void readLabels(const Mat& img, const vector<Stroke>& strokes, vector<Rect>& crops, vector<int>& scales, vector<TextBox>& result) {
+    auto start = Clock::now();
+    vector<Rect> reach;
+    for (size_t i : measurementCandidates(strokes)) {
+        reach.push_back(grow(strokeBounds(strokes[i]), MEASUREMENT_TEXT_REACH, MEASUREMENT_TEXT_REACH));
+    }
+    auto nearLine = [&](const Rect& crop) {
+        for (auto& r : reach) {
+            if ((r & crop).area() > 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    size_t kept = 0, tried = 0, total = crops.size();
+    for (size_t i = 0; i < crops.size(); ++i) {
+        TextBox label;
+        bool read = false;
+        if (nearLine(crops[i])) {
+            ++tried;
+            read = recognizeLabel(img(crops[i]), crops[i].tl(), label);
+        }
+        if (read) {
+            result.push_back(label);
+        } else {
+            crops[kept] = crops[i];
+            scales[kept] = scales[i];
+            ++kept;
+        }
+    }
+    crops.resize(kept);
+    scales.resize(kept);
+    cerr << "ocr: read " << total - kept << " of " << tried << " crops near measurement lines (of " << total
+         << ") as labels in " << millisSince(start) << " ms" << endl;
+}
+
+vector<TextBox> findText(const Mat& img, const OcrOptions& options) {
+    return findText(img, vector<Stroke>(), options);
+}
+
+vector<TextBox> findText(const Mat& img, const vector<Stroke>& strokes, const OcrOptions& options) {
+    vector<TextBox> result;
+
+    if (options.upscaling == UPSCALE_TEXT_CROPS) {
+        vector<int> scales;
+        vector<Rect> crops = glyphCrops(img, scales);
+        if (options.fastLabels) {
+            readLabels(img, strokes, crops, scales, result);
+        }
+        recognizeRegions(cropRegions(img, crops, scales, options.threads), options, result);
+        logTextBoxes(result);
+        logCache(options);
+        return result;
+    }
 
+    Mat pp; // preprocessed
+    preprocess(img, UPSCALE, pp);
+
+    // Mat scldown;
+    // resize(pp, scldown, Size(0, 0), .25, .25, INTER_CUBIC);
+    // imshow("text preprocessing", scldown);
+
+    if (options.threads == 1) {
+        OcrLease ocr(OcrEnginePool::shared());
+        noteReuse(ocr);
+        recognize(ocr.get(), options, pp, Point(0, 0), UPSCALE, result);
+    } else {
+        recognizeRegions(lineRegions(pp), options, result);
+    }
+
+    logTextBoxes(result);
+    logCache(options);
+    return result;
+}
+
+// the parts of the page where text could end up with a vote
+static vector<Rect> textCandidates(const vector<Stroke>& strokes, const Rect& page) {
+    vector<Rect> crops;
+    for (size_t i : measurementCandidates(strokes)) {
+        const Stroke& s = strokes[i];
+        if (mostlyVertical(s.line)) {
+            crops.push_back(grow(strokeBounds(s), MEASUREMENT_TEXT_REACH + LABEL_SIZE, LABEL_SIZE) & page);
+        } else {
+            crops.push_back(grow(strokeBounds(s), LABEL_SIZE, MEASUREMENT_TEXT_REACH + LABEL_SIZE) & page);
+        }
+    }
+    vector<Stroke> shortStrokes;
+    for (auto& s : strokes) {
+        if (segmentLength(s.line) < MEASUREMENT_STROKE_MIN) {
+            shortStrokes.push_back(s);
+        }
+    }
+
+    // single strokes count too: "1", "-" and "I" are one stroke each
+    auto extentOf = [](const Stroke& s) {
+        return Extent {
+            (double)min(s.line[0], s.line[2]), (double)min(s.line[1], s.line[3]),
+            (double)max(s.line[0], s.line[2]), (double)max(s.line[1], s.line[3]) };
+    };
+    auto near = [](const Stroke& s1, const Stroke& s2) {
+        return closestApproach(s1.line, s2.line) < HANDWRITING_GAP;
+    };
+    for (auto& cluster : groupSpatial(shortStrokes, near, extentOf, HANDWRITING_GAP + 1)) {
+        Rect bounds = strokeBounds(cluster[0]);
+        for (auto& s : cluster) {
+            bounds |= strokeBounds(s);
+        }
+        crops.push_back(grow(bounds, HANDWRITING_MARGIN, HANDWRITING_MARGIN) & page);
+    }
+
+    mergeOverlapping(crops, CROP_MERGE_GROWTH);
+    return crops;
+}
+
+vector<TextBox> findTextNearStrokes(const Mat& img, const vector<Stroke>& strokes, const OcrOptions& options) {
+    const vector<Rect> crops = textCandidates(strokes, Rect(0, 0, img.size().width, img.size().height));
+    vector<TextBox> result;
+    recognizeRegions(cropRegions(img, crops, vector<int>(crops.size(), UPSCALE), options.threads), options, result);
+    logTextBoxes(result);
+    logCache(options);
     return result;
 }
 
@@ -1,16 +1,128 @@
 #ifndef OCR_H
 #define OCR_H 1
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <opencv2/core/core.hpp>
 
+#include "strokes.hpp"
+
+namespace tesseract {
+    class TessBaseAPI;
+}
+
+class OcrCache;
+
 struct TextBox {
     cv::Rect boundary;
     const char* text;
+    int confidence; // 0-100, as reported by Tesseract
+};
+
+enum OcrMode {
+    OCR_SINGLE_PASS, // recognize the page once and read the words back
+    OCR_PER_WORD,    // find word boxes, then recognize each one on its own
+};
+
+enum OcrUpscaling {
+    UPSCALE_PAGE,       // upscale the whole page 3x before recognizing it
+    UPSCALE_TEXT_CROPS, // find glyphs at native size, upscale only crops around them
+};
+
+struct OcrOptions {
+    OcrMode mode = OCR_SINGLE_PASS;
+    OcrUpscaling upscaling = UPSCALE_PAGE;
+
+    // With UPSCALE_TEXT_CROPS, try reading each crop near a stroke that
+    // might be a measurement line as a label first (see labels.hpp), and only
+    // send the rest to Tesseract. Needs the strokes passed to findText.
+    bool fastLabels = false;
+
+    // Above 1, the page is split into text lines that are recognized on this
+    // many threads at once (crops are always recognized separately, on this
+    // many threads). 0 means one thread per core.
+    int threads = 1;
+
+    // If set, recognized words are looked up here first and stored here
+    // after; see ocrcache.hpp.
+    OcrCache* cache = nullptr;
+};
+
+/**
+ * Tesseract engines that are initialized once and then lent out. Loading
+ * the language model is most of the cost of a fresh engine, so findText
+ * borrows one from here instead of building its own for every image.
+ */
+class OcrEnginePool {
+public:
+    OcrEnginePool(int capacity, const char* language = "eng");
+    ~OcrEnginePool();
+
+    /**
+     * Borrows an engine. An idle one is reused if there is one; otherwise a
+     * new one is initialized unless the pool is full, in which case this
+     * waits. If `reused` is given it says which of those happened.
+     */
+    tesseract::TessBaseAPI* acquire(bool* reused = nullptr);
+
+    /** gives an engine back, clearing everything its last user set up */
+    void release(tesseract::TessBaseAPI* engine);
+
+    const char* languageName() const { return language; }
+
+    /** average time it took to initialize one engine, in ms */
+    double initMillis();
+
+    /** the process-wide pool, with at most one engine per core */
+    static OcrEnginePool& shared();
+
+private:
+    OcrEnginePool(const OcrEnginePool&) = delete;
+    OcrEnginePool& operator=(const OcrEnginePool&) = delete;
+
+    const int capacity;
+    const char* language;
+    std::mutex lock;
+    std::condition_variable returned;
+    std::vector<tesseract::TessBaseAPI*> all;
+    std::vector<tesseract::TessBaseAPI*> idle;
+    int initializing;
+    double totalInitMillis;
+};
+
+/** an engine borrowed from a pool for as long as the lease lives */
+class OcrLease {
+public:
+    OcrLease(OcrEnginePool& pool) : pool(pool), wasReused(false), engine(pool.acquire(&wasReused)) { }
+    ~OcrLease() { pool.release(engine); }
+    tesseract::TessBaseAPI* get() const { return engine; }
+    tesseract::TessBaseAPI* operator->() const { return engine; }
+    bool reused() const { return wasReused; }
+private:
+    OcrLease(const OcrLease&) = delete;
+    OcrLease& operator=(const OcrLease&) = delete;
+
+    OcrEnginePool& pool;
+    bool wasReused;
+    tesseract::TessBaseAPI* engine;
 };
 
-std::vector<TextBox> findText(const cv::Mat& img);
+std::vector<TextBox> findText(const cv::Mat& img, const OcrOptions& options = OcrOptions());
+
+/**
+ * Like findText, but with fastLabels, crops within MEASUREMENT_TEXT_REACH
+ * of `strokes` that might be measurement lines are read as labels first.
+ */
+std::vector<TextBox> findText(const cv::Mat& img, const std::vector<Stroke>& strokes, const OcrOptions& options = OcrOptions());
+
+/**
+ * Like findText, but only recognizes crops of the page where text could
+ * still earn a vote: beside strokes that might be measurement lines, and
+ * around clusters of short strokes that look like handwriting.
+ */
+std::vector<TextBox> findTextNearStrokes(const cv::Mat& img, const std::vector<Stroke>& strokes, const OcrOptions& options = OcrOptions());
 cv::Mat displayText(const cv::Mat& bg, const std::vector<TextBox>& textBoxes);
 
 #endif
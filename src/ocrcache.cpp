@@ -0,0 +1,202 @@
+#include "ocrcache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace std;
+
+static const char* SUFFIX = ".ocr";
+
+static double now() {
+    return chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+OcrCache::OcrCache(const string& dir, size_t maxBytes)
+    : dir(dir), maxBytes(maxBytes), totalBytes(0), hitCount(0), missCount(0) {
+
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        cerr << "ocr cache: could not create '" << dir << "': " << strerror(errno) << endl;
+        return;
+    }
+
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        cerr << "ocr cache: could not open '" << dir << "': " << strerror(errno) << endl;
+        return;
+    }
+    while (dirent* e = readdir(d)) {
+        const char* name = e->d_name;
+        if (strlen(name) != 16 + strlen(SUFFIX) || strcmp(name + 16, SUFFIX) != 0) {
+            continue;
+        }
+        char* end;
+        uint64_t k = strtoull(name, &end, 16);
+        struct stat st;
+        if (end != name + 16 || stat(path(k).c_str(), &st) != 0) {
+            continue;
+        }
+        entries[k] = Entry { (double)st.st_mtime, (size_t)st.st_size };
+        totalBytes += st.st_size;
+    }
+    closedir(d);
+
+    lock_guard<mutex> guard(lock);
+    evict();
+}
+
+uint64_t OcrCache::key(const Mat& pp, const string& settings) {
+    // 64-bit FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    auto mix = [&h](const unsigned char* bytes, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            h = (h ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+    int shape[] = { pp.rows, pp.cols, pp.type() };
+    mix((const unsigned char*)settings.data(), settings.size());
+    mix((const unsigned char*)shape, sizeof(shape));
+    for (int y = 0; y < pp.rows; ++y) {
+        mix(pp.ptr(y), pp.cols * pp.elemSize());
+    }
+    return h;
+}
+
+string OcrCache::path(uint64_t key) const {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+    return dir + '/' + name + SUFFIX;
+}
+
+bool OcrCache::lookup(uint64_t key, vector<TextBox>& words) {
+    {
+        lock_guard<mutex> guard(lock);
+        auto e = entries.find(key);
+        if (e == entries.end()) {
+            ++missCount;
+            return false;
+        }
+        e->second.lastUse = now();
+    }
+
+    // file format: a word count, then per word "x y w h conf length\n" and
+    // `length` bytes of text
+    ifstream in(path(key), ios::binary);
+    size_t count = 0;
+    in >> count;
+    vector<TextBox> read;
+    for (size_t i = 0; in && i < count; ++i) {
+        int x, y, w, h, conf;
+        size_t length;
+        in >> x >> y >> w >> h >> conf >> length;
+        in.get();
+        char* text = new char[length + 1];
+        in.read(text, length);
+        text[length] = '\0';
+        read.push_back(TextBox { Rect(x, y, w, h), text, conf });
+    }
+
+    lock_guard<mutex> guard(lock);
+    if (!in) {
+        // damaged, or deleted by someone else
+        for (auto& w : read) {
+            delete[] w.text;
+        }
+        auto e = entries.find(key);
+        if (e != entries.end()) {
+            totalBytes -= e->second.bytes;
+            entries.erase(e);
+        }
+        ++missCount;
+        return false;
+    }
+    utimes(path(key).c_str(), nullptr);
+    words.insert(words.end(), read.begin(), read.end());
+    ++hitCount;
+    return true;
+}
+
+void OcrCache::store(uint64_t key, const vector<TextBox>& words) {
+    // write to a temporary and rename it, so readers never see half a file;
+    // the name is unique per process and thread, as caches may be shared
+    string target = path(key);
+    string temp = target + '.' + to_string(getpid()) + '.' + to_string(hash<thread::id>()(this_thread::get_id()));
+    {
+        ofstream out(temp, ios::binary);
+        out << words.size() << '\n';
+        for (auto& w : words) {
+            const Rect& r = w.boundary;
+            size_t length = strlen(w.text);
+            out << r.x << ' ' << r.y << ' ' << r.width << ' ' << r.height << ' ' << w.confidence << ' ' << length << '\n';
+            out.write(w.text, length);
+            out << '\n';
+        }
+        if (!out) {
+            cerr << "ocr cache: could not write '" << temp << '\'' << endl;
+            remove(temp.c_str());
+            return;
+        }
+    }
+    struct stat st;
+    if (rename(temp.c_str(), target.c_str()) != 0 || stat(target.c_str(), &st) != 0) {
+        cerr << "ocr cache: could not write '" << target << "': " << strerror(errno) << endl;
+        remove(temp.c_str());
+        return;
+    }
+
+    lock_guard<mutex> guard(lock);
+    auto e = entries.find(key);
+    if (e != entries.end()) {
+        totalBytes -= e->second.bytes;
+    }
+    entries[key] = Entry { now(), (size_t)st.st_size };
+    totalBytes += st.st_size;
+    evict();
+}
+
+// Deletes least recently used entries until the cache fits. Call with the
+// lock held.
+void OcrCache::evict() {
+    if (totalBytes <= maxBytes) {
+        return;
+    }
+    vector<pair<double, uint64_t>> byAge;
+    for (auto& e : entries) {
+        byAge.push_back(make_pair(e.second.lastUse, e.first));
+    }
+    sort(byAge.begin(), byAge.end());
+    for (auto& old : byAge) {
+        if (totalBytes <= maxBytes) {
+            break;
+        }
+        remove(path(old.second).c_str());
+        totalBytes -= entries[old.second].bytes;
+        entries.erase(old.second);
+    }
+}
+
+unsigned OcrCache::hits() {
+    lock_guard<mutex> guard(lock);
+    return hitCount;
+}
+
+unsigned OcrCache::misses() {
+    lock_guard<mutex> guard(lock);
+    return missCount;
+}
+
+size_t OcrCache::bytes() {
+    lock_guard<mutex> guard(lock);
+    return totalBytes;
+}
@@ -0,0 +1,66 @@
+#ifndef OCRCACHE_H
+#define OCRCACHE_H 1
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "ocr.hpp"
+
+/**
+ * Recognized words stored on disk, one file per preprocessed image, keyed
+ * by a hash of its pixels and of the settings it was recognized with. Word
+ * boxes are kept in the image's own coordinates so that the same crop can
+ * be found again anywhere on the page.
+ *
+ * When the files add up to more than the size limit, the least recently
+ * used ones are deleted. Every method may be called from several threads.
+ */
+class OcrCache {
+public:
+    static const size_t DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+
+    /** uses (and creates, if need be) directory `dir` */
+    OcrCache(const std::string& dir, size_t maxBytes = DEFAULT_MAX_BYTES);
+
+    /** the key for image `pp` recognized with `settings` */
+    static uint64_t key(const cv::Mat& pp, const std::string& settings);
+
+    /**
+     * Reads the words stored under `key` into `words` (whose text the
+     * caller must delete[]) and returns true, or returns false if there are
+     * none.
+     */
+    bool lookup(uint64_t key, std::vector<TextBox>& words);
+
+    void store(uint64_t key, const std::vector<TextBox>& words);
+
+    unsigned hits();
+    unsigned misses();
+    size_t bytes();
+
+private:
+    OcrCache(const OcrCache&) = delete;
+    OcrCache& operator=(const OcrCache&) = delete;
+
+    struct Entry {
+        double lastUse; // seconds since the epoch
+        size_t bytes;
+    };
+
+    std::string path(uint64_t key) const;
+    void evict();
+
+    const std::string dir;
+    const size_t maxBytes;
+    std::mutex lock;
+    std::map<uint64_t, Entry> entries;
+    size_t totalBytes;
+    unsigned hitCount;
+    unsigned missCount;
+};
+
+#endif
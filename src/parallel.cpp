@@ -0,0 +1,6 @@
+#include "parallel.hpp"
+
+int defaultThreadCount() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
@@ -0,0 +1,49 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H 1
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/** number of worker threads to use when the caller doesn't specify one */
+int defaultThreadCount();
+
+/**
+ * Calls f(i) for every i in [0, n) on up to `nthreads` threads (including
+ * the calling one). Indices are handed out one at a time, so f should do a
+ * reasonable amount of work per call. Returns once every call has finished.
+ */
+template <class F>
+void parallelFor(size_t n, int nthreads, F f) {
+    if (nthreads <= 0) {
+        nthreads = defaultThreadCount();
+    }
+    if ((size_t)nthreads > n) {
+        nthreads = n;
+    }
+    if (nthreads <= 1) {
+        for (size_t i = 0; i < n; ++i) {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < n; i = next++) {
+            f(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nthreads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+#endif
@@ -1,27 +1,399 @@
 #include "segments.hpp"
 #include "geometry.hpp"
+#include "parallel.hpp"
+#include "UnionFind.hpp"
+#include <cstring>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace cv;
 using namespace std;
 
-static Mat cleanup(Mat m, unsigned char thresh) {
-    for (int row = 0; row < m.rows; ++row) {
-        for (int col = 0; col < m.cols; ++col) {
-            unsigned char& val = m.at<unsigned char>(row, col);
-            val = val < thresh ? 0 : 0xff;
+// Scalar kernel, also used for the tail of each row in the SIMD versions.
+// Note that 255 - v == v ^ 0xff for bytes, so inverting never saturates.
+static void binarizeInvertedRow(const unsigned char* src, unsigned char* dst, int n, unsigned char thresh) {
+    for (int i = 0; i < n; ++i) {
+        unsigned char inv = src[i] ^ 0xff;
+        dst[i] = inv < thresh ? 0 : 0xff;
+    }
+}
+
+void binarizeInverted(const Mat& src, unsigned char thresh, Mat& dst) {
+    CV_Assert(src.type() == CV_8UC1);
+    dst.create(src.size(), CV_8UC1);
+
+    for (int row = 0; row < src.rows; ++row) {
+        const unsigned char* in = src.ptr<unsigned char>(row);
+        unsigned char* out = dst.ptr<unsigned char>(row);
+        int col = 0;
+
+#if defined(__AVX2__)
+        const __m256i ones = _mm256_set1_epi8((char)0xff);
+        const __m256i t = _mm256_set1_epi8((char)thresh);
+        for (; col + 32 <= src.cols; col += 32) {
+            __m256i inv = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(in + col)), ones);
+            // inv >= t  <=>  max(inv, t) == inv   (unsigned)
+            __m256i mask = _mm256_cmpeq_epi8(_mm256_max_epu8(inv, t), inv);
+            _mm256_storeu_si256((__m256i*)(out + col), mask);
+        }
+#elif defined(__SSE2__)
+        const __m128i ones = _mm_set1_epi8((char)0xff);
+        const __m128i t = _mm_set1_epi8((char)thresh);
+        for (; col + 16 <= src.cols; col += 16) {
+            __m128i inv = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + col)), ones);
+            // inv >= t  <=>  max(inv, t) == inv   (unsigned)
+            __m128i mask = _mm_cmpeq_epi8(_mm_max_epu8(inv, t), inv);
+            _mm_storeu_si128((__m128i*)(out + col), mask);
         }
+#endif
+
+        binarizeInvertedRow(in + col, out + col, src.cols - col, thresh);
     }
-    return m;
 }
 
-vector<Vec4i> findSegments(const Mat& img) {
-    Mat dst = cleanup(Scalar::all(255) - img, 10);
+static const int    HOUGH_VOTES     = 20;
+static const double MIN_LINE_LENGTH = 10;
+static const double MAX_LINE_GAP    = 25;
+
+static vector<Vec4i> hough(const Mat& binarized) {
     vector<Vec4i> lines;
-    HoughLinesP(dst, lines, 1, TAU/360, 20, 10, 25);
+    HoughLinesP(binarized, lines, 1, TAU/360, HOUGH_VOTES, MIN_LINE_LENGTH, MAX_LINE_GAP);
     return lines;
 }
 
+// Tiles are TILE_SIZE pixels square, plus TILE_OVERLAP pixels borrowed from
+// each neighbour. The overlap is wider than MIN_LINE_LENGTH + MAX_LINE_GAP,
+// so a short segment near a seam (at most TILE_OVERLAP long) is seen whole
+// by at least one tile. Longer segments that cross a seam are cut at the
+// tiles' edges, which lie within TILE_OVERLAP of the seam, and the pieces
+// are stitched back together in houghTiled.
+static const int TILE_SIZE    = 512;
+static const int TILE_OVERLAP = 40;
+
+// Pieces of one line found in neighbouring tiles are joined if they are this
+// close and nearly parallel.
+static const double SEAM_JOIN_DISTANCE = 3.0;
+static const double SEAM_JOIN_COS      = 0.98;
+
+static bool nearSeam(int v, int extent) {
+    int seam = (v + TILE_SIZE/2) / TILE_SIZE * TILE_SIZE;
+    return seam > 0 && seam < extent && abs(v - seam) <= TILE_OVERLAP;
+}
+
+static bool sameLine(const Vec4i& l1, const Vec4i& l2) {
+    auto d1 = dirOf(l1);
+    auto d2 = dirOf(l2);
+    double n = norm(d1) * norm(d2);
+    return n > 0 &&
+        abs(d1.ddot(d2)) / n >= SEAM_JOIN_COS &&
+        closestApproach(l1, l2) <= SEAM_JOIN_DISTANCE;
+}
+
+// the extreme endpoints of a group of (nearly) collinear segments
+static Vec4i joinCollinear(const vector<Vec4i>& lines) {
+    Vec4i longest = lines[0];
+    for (auto& l : lines) {
+        if (segmentLength(l) > segmentLength(longest)) {
+            longest = l;
+        }
+    }
+    const Vec2d dir = dirOf(longest);
+    double lo = 0, hi = 0;
+    Vec2i loPt = p1(longest), hiPt = p1(longest);
+    for (auto& l : lines) {
+        for (const Vec2i& pt : { p1(l), p2(l) }) {
+            double t = (pt[0] - longest[0]) * dir[0] + (pt[1] - longest[1]) * dir[1];
+            if (t < lo) { lo = t; loPt = pt; }
+            if (t > hi) { hi = t; hiPt = pt; }
+        }
+    }
+    return Vec4i(loPt[0], loPt[1], hiPt[0], hiPt[1]);
+}
+
+static vector<Vec4i> houghTiled(const Mat& binarized, int threads) {
+    const Rect page(0, 0, binarized.cols, binarized.rows);
+    const int ncols = (binarized.cols + TILE_SIZE - 1) / TILE_SIZE;
+    const int nrows = (binarized.rows + TILE_SIZE - 1) / TILE_SIZE;
+
+    vector<vector<Vec4i>> found(ncols * nrows);
+    parallelFor(found.size(), threads, [&](size_t i) {
+        Rect core = Rect(i % ncols * TILE_SIZE, i / ncols * TILE_SIZE, TILE_SIZE, TILE_SIZE) & page;
+        Rect tile = Rect(
+            core.x - TILE_OVERLAP, core.y - TILE_OVERLAP,
+            core.width + 2*TILE_OVERLAP, core.height + 2*TILE_OVERLAP) & page;
+        for (auto& l : hough(binarized(tile))) {
+            Vec4i shifted(l[0] + tile.x, l[1] + tile.y, l[2] + tile.x, l[3] + tile.y);
+            // every segment is reported by exactly one tile: the one whose
+            // core holds its midpoint
+            Vec2i mid = midpoint(shifted);
+            if (core.contains(Point(mid[0], mid[1]))) {
+                found[i].push_back(shifted);
+            }
+        }
+    });
+
+    // stitch together pieces of lines that cross a seam
+    vector<Vec4i> result, seams;
+    for (auto& lines : found) {
+        for (auto& l : lines) {
+            bool seam =
+                nearSeam(l[0], binarized.cols) || nearSeam(l[2], binarized.cols) ||
+                nearSeam(l[1], binarized.rows) || nearSeam(l[3], binarized.rows);
+            (seam ? seams : result).push_back(l);
+        }
+    }
+    for (auto& g : group(seams, sameLine)) {
+        result.push_back(joinCollinear(g));
+    }
+    return result;
+}
+
+// The pyramid engine looks for lines on a copy of the page shrunk by a power
+// of two until its long side is at most PYRAMID_TARGET_SIZE pixels.
+static const int PYRAMID_TARGET_SIZE = 1024;
+
+// Walks a coarse candidate line at full resolution and fits it to the ink
+// nearby. Pixels up to `band` away from the line (measured perpendicular to
+// it) are searched, and the line may grow or shrink by up to `pad` pixels at
+// either end. Returns false if no run of ink long enough remains.
+static bool refineSegment(const Mat& binarized, const Vec4d& candidate, double band, double pad, Vec4i& result) {
+    const double len = segmentLength(candidate);
+    if (len <= 0) {
+        return false;
+    }
+    const Vec2d u = dirOf(candidate) * (1.0 / len); // along the line
+    const Vec2d n(-u[1], u[0]);                     // across the line
+    const int w = ceil(band);
+    const int steps = ceil(len + 2*pad);
+
+    // for each step along the line: is there ink, and how far off the line?
+    vector<char> hit(steps + 1, 0);
+    vector<double> offset(steps + 1, 0.0);
+    for (int i = 0; i <= steps; ++i) {
+        const double t = i - pad;
+        const double cx = candidate[0] + t * u[0];
+        const double cy = candidate[1] + t * u[1];
+        int nhits = 0;
+        double sum = 0;
+        for (int k = -w; k <= w; ++k) {
+            int x = round(cx + k * n[0]);
+            int y = round(cy + k * n[1]);
+            if (x >= 0 && y >= 0 && x < binarized.cols && y < binarized.rows &&
+                    binarized.at<unsigned char>(y, x)) {
+                ++nhits;
+                sum += k;
+            }
+        }
+        if (nhits > 0) {
+            hit[i] = 1;
+            offset[i] = sum / nhits;
+        }
+    }
+
+    // longest run of ink, bridging gaps up to MAX_LINE_GAP like HoughLinesP
+    int bestStart = -1, bestEnd = -1;
+    int start = -1, last = -1;
+    for (int i = 0; i <= steps; ++i) {
+        if (!hit[i]) {
+            continue;
+        }
+        if (start < 0 || i - last > MAX_LINE_GAP) {
+            start = i;
+        }
+        last = i;
+        if (bestStart < 0 || last - start > bestEnd - bestStart) {
+            bestStart = start;
+            bestEnd = last;
+        }
+    }
+    if (bestStart < 0 || bestEnd - bestStart < MIN_LINE_LENGTH) {
+        return false;
+    }
+
+    const double t0 = bestStart - pad;
+    const double t1 = bestEnd - pad;
+    result = Vec4i(
+        round(candidate[0] + t0 * u[0] + offset[bestStart] * n[0]),
+        round(candidate[1] + t0 * u[1] + offset[bestStart] * n[1]),
+        round(candidate[0] + t1 * u[0] + offset[bestEnd] * n[0]),
+        round(candidate[1] + t1 * u[1] + offset[bestEnd] * n[1]));
+    return true;
+}
+
+static vector<Vec4i> houghPyramid(const Mat& binarized) {
+    int factor = 1;
+    while (max(binarized.cols, binarized.rows) / factor > PYRAMID_TARGET_SIZE) {
+        factor *= 2;
+    }
+    if (factor == 1) {
+        return hough(binarized);
+    }
+
+    // any ink in a block of the full image marks the coarse pixel
+    Mat coarse;
+    resize(binarized, coarse, Size(0, 0), 1.0 / factor, 1.0 / factor, INTER_AREA);
+    threshold(coarse, coarse, 0, 255, CV_THRESH_BINARY);
+
+    vector<Vec4i> candidates;
+    HoughLinesP(coarse, candidates, 1, TAU/360,
+        max(HOUGH_VOTES / factor, 5),
+        max(MIN_LINE_LENGTH / factor, 3.0),
+        max(MAX_LINE_GAP / factor, 1.0));
+
+    // a coarse pixel covers `factor` fine pixels, so that is how far off
+    // the candidates can be
+    vector<Vec4i> result;
+    for (auto& c : candidates) {
+        const double half = factor / 2.0;
+        Vec4d scaled(
+            c[0] * factor + half, c[1] * factor + half,
+            c[2] * factor + half, c[3] * factor + half);
+        Vec4i refined;
+        if (refineSegment(binarized, scaled, factor + 1, 2 * factor, refined)) {
+            result.push_back(refined);
+        }
+    }
+    return result;
+}
+
+// Inside a row, ink separated by at most RUN_GAP background pixels still
+// counts as one run.
+static const int RUN_GAP = 3;
+
+// A stack of horizontal runs in consecutive rows that overlap each other:
+// one (possibly thick or slightly slanted) horizontal stroke.
+struct RunTrack {
+    int x0, x1;               // extent of the most recent run
+    int minX, maxX;           // extent of the whole track
+    long minXRows, maxXRows;  // sum of the rows where minX and maxX were seen
+    int minXCount, maxXCount; // ...and how many rows that was
+    int rows;
+};
+
+static RunTrack startTrack(int x0, int x1, int y) {
+    return RunTrack { x0, x1, x0, x1, y, y, 1, 1, 1 };
+}
+
+static void extendTrack(RunTrack& t, int x0, int x1, int y) {
+    t.x0 = x0;
+    t.x1 = x1;
+    ++t.rows;
+    if (x0 < t.minX) {
+        t.minX = x0; t.minXRows = y; t.minXCount = 1;
+    } else if (x0 == t.minX) {
+        t.minXRows += y; ++t.minXCount;
+    }
+    if (x1 > t.maxX) {
+        t.maxX = x1; t.maxXRows = y; t.maxXCount = 1;
+    } else if (x1 == t.maxX) {
+        t.maxXRows += y; ++t.maxXCount;
+    }
+}
+
+static void closeTrack(const RunTrack& t, bool transposed, vector<Vec4i>& out) {
+    int len = t.maxX - t.minX + 1;
+    // blobs and glyphs are not strokes
+    if (len < MIN_LINE_LENGTH || t.rows > len / 2) {
+        return;
+    }
+    int y0 = round((double)t.minXRows / t.minXCount);
+    int y1 = round((double)t.maxXRows / t.maxXCount);
+    out.push_back(transposed ?
+        Vec4i(y0, t.minX, y1, t.maxX) :
+        Vec4i(t.minX, y0, t.maxX, y1));
+}
+
+// Finds the horizontal strokes in an image in one pass over its rows. Each
+// row is run-length encoded and every long enough run either continues the
+// track it overlaps in the previous row or starts a new one. Both lists are
+// sorted by x, so matching them up is a merge.
+static void horizontalRuns(const Mat& binarized, bool transposed, vector<Vec4i>& out) {
+    vector<RunTrack> active, next;
+    for (int y = 0; y < binarized.rows; ++y) {
+        const unsigned char* row = binarized.ptr<unsigned char>(y);
+        size_t t = 0;
+        int x = 0;
+        next.clear();
+        while (x < binarized.cols) {
+            while (x < binarized.cols && !row[x]) {
+                ++x;
+            }
+            if (x == binarized.cols) {
+                break;
+            }
+            int x0 = x, x1 = x;
+            for (; x < binarized.cols && x - x1 <= RUN_GAP; ++x) {
+                if (row[x]) {
+                    x1 = x;
+                }
+            }
+            if (x1 - x0 + 1 < MIN_LINE_LENGTH) {
+                continue;
+            }
+
+            // tracks entirely to the left of this run have ended
+            for (; t < active.size() && active[t].x1 < x0; ++t) {
+                closeTrack(active[t], transposed, out);
+            }
+            if (t < active.size() && active[t].x0 <= x1) {
+                next.push_back(active[t++]);
+                extendTrack(next.back(), x0, x1, y);
+            } else {
+                next.push_back(startTrack(x0, x1, y));
+            }
+        }
+        for (; t < active.size(); ++t) {
+            closeTrack(active[t], transposed, out);
+        }
+        swap(active, next);
+    }
+    for (auto& track : active) {
+        closeTrack(track, transposed, out);
+    }
+}
+
+static vector<Vec4i> axisAlignedRuns(const Mat& binarized) {
+    vector<Vec4i> result;
+    horizontalRuns(binarized, false, result);
+    Mat columns;
+    transpose(binarized, columns);
+    horizontalRuns(columns, true, result);
+    return result;
+}
+
+bool parseSegmentEngine(const char* name, SegmentEngine& engine) {
+    if (strcmp(name, "hough") == 0) {
+        engine = SEGMENTS_HOUGH;
+    } else if (strcmp(name, "tiled") == 0) {
+        engine = SEGMENTS_TILED;
+    } else if (strcmp(name, "pyramid") == 0) {
+        engine = SEGMENTS_PYRAMID;
+    } else if (strcmp(name, "runs") == 0) {
+        engine = SEGMENTS_RUNS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+vector<Vec4i> findSegments(const Mat& img, SegmentEngine engine, int threads) {
+    // reused between calls so large scans don't pay for a fresh allocation
+    static thread_local Mat dst;
+    binarizeInverted(img, 10, dst);
+    switch (engine) {
+        case SEGMENTS_HOUGH:   return hough(dst);
+        case SEGMENTS_TILED:   return houghTiled(dst, threads);
+        case SEGMENTS_PYRAMID: return houghPyramid(dst);
+        case SEGMENTS_RUNS:    return axisAlignedRuns(dst);
+    }
+    return vector<Vec4i>();
+}
+
 cv::Mat displaySegments(const cv::Mat& bg, const std::vector<cv::Vec4i>& segments) {
     Mat display;
     cvtColor(bg, display, CV_GRAY2BGR);
@@ -4,7 +4,32 @@
 #include <vector>
 #include <opencv2/core/core.hpp>
 
-std::vector<cv::Vec4i> findSegments(const cv::Mat& img);
+/**
+ * Inverts an 8-bit grayscale image and thresholds it in one pass: output
+ * pixels are 0xff where 255 - src >= thresh and 0 elsewhere. The result is
+ * identical to thresholding `Scalar::all(255) - src`, but no temporary is
+ * allocated and dst is reused if it already has the right size and type.
+ */
+void binarizeInverted(const cv::Mat& src, unsigned char thresh, cv::Mat& dst);
+
+enum SegmentEngine {
+    SEGMENTS_HOUGH,   // one probabilistic Hough transform over the whole page
+    SEGMENTS_TILED,   // Hough on overlapping tiles in parallel, stitched at the seams
+    SEGMENTS_PYRAMID, // Hough on a downsampled page, endpoints refined at full size
+    SEGMENTS_RUNS,    // horizontal and vertical ink runs only; no Hough transform
+};
+
+/** parses an engine name as given on the command line ("hough", "tiled", ...) */
+bool parseSegmentEngine(const char* name, SegmentEngine& engine);
+
+/**
+ * Finds line segments in a grayscale image. `threads` only affects the
+ * tiled engine; 0 means one per core.
+ */
+std::vector<cv::Vec4i> findSegments(
+    const cv::Mat& img,
+    SegmentEngine engine = SEGMENTS_HOUGH,
+    int threads = 0);
 cv::Mat displaySegments(const cv::Mat& bg, const std::vector<cv::Vec4i>& segments);
 
 #endif
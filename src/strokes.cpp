@@ -1,6 +1,7 @@
 #include "strokes.hpp"
 #include "UnionFind.hpp"
 #include "geometry.hpp"
+#include "parallel.hpp"
 #include <opencv2/imgproc/imgproc.hpp>
 
 using namespace cv;
@@ -39,11 +40,19 @@ static double dominantAngle(const vector<Vec4i>& lines, int nbuckets = 8) {
     return topBucket * (TAU/nbuckets);
 }
 
+static const double TOO_CLOSE = 10.0;
+
 static bool segmentsTooClose(const Vec4i& v1, const Vec4i& v2) {
     auto vd1 = dirOf(v1);
     auto vd2 = dirOf(v2);
     double d = abs(vd1.ddot(vd2) / (norm(vd1) * norm(vd2)));
-    return d >= 0.8 && closestApproach(v1, v2) < 10.0;
+    return d >= 0.8 && closestApproach(v1, v2) < TOO_CLOSE;
+}
+
+static Extent segmentExtent(const Vec4i& v) {
+    return Extent {
+        (double)min(v[0], v[2]), (double)min(v[1], v[3]),
+        (double)max(v[0], v[2]), (double)max(v[1], v[3]) };
 }
 
 static Vec2d centroid(const vector<Vec4i>& lines) {
@@ -114,7 +123,8 @@ static Stroke mergeLines(const vector<Vec4i>& lines) {
 
 vector<Stroke> findStrokes(const vector<Vec4i>& segments) {
     vector<Stroke> strokes;
-    for (const auto& g : group(segments, segmentsTooClose)) {
+    // the extra pixel of slack keeps the grid exact despite rounding
+    for (const auto& g : groupSpatial(segments, segmentsTooClose, segmentExtent, TOO_CLOSE + 1, defaultThreadCount())) {
         strokes.push_back(mergeLines(g));
     }
     return strokes;
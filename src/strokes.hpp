@@ -4,6 +4,9 @@
 #include <vector>
 #include <opencv2/core/core.hpp>
 
+// how far (in pixels) text may sit from a line and still label it
+static const int MEASUREMENT_TEXT_REACH = 100;
+
 struct Stroke {
     cv::Vec4i line;
     double angle;
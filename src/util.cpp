@@ -1 +1,7 @@
 #include "util.hpp"
+
+using namespace std;
+
+double millisSince(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
@@ -1,8 +1,14 @@
 #ifndef UTIL_H
 #define UTIL_H 1
 
+#include <chrono>
 #include <map>
 
+typedef std::chrono::steady_clock Clock;
+
+/** milliseconds elapsed since `start` */
+double millisSince(Clock::time_point start);
+
 template <class It>
 auto mode(It start, const It& end) -> typename It::value_type {
     typedef typename It::value_type T;
@@ -13,6 +19,7 @@ auto mode(It start, const It& end) -> typename It::value_type {
         const T& v = *start;
         int count = ++counts[v];
         if (count > bestCount) {
+            bestCount = count;
             bestVal = v;
         }
     }
@@ -2,6 +2,8 @@
 #include "geometry.hpp"
 #include "util.hpp"
 #include <algorithm>
+#include <cmath>
+#include <utility>
 #include <opencv2/imgproc/imgproc.hpp>
 
 const static TextBox NO_TEXT { };
@@ -10,12 +12,97 @@ using namespace std;
 using namespace cv;
 
 bool operator==(const VotedStroke& v1, const VotedStroke& v2) {
-    return v1.stroke == v2.stroke && v1.votes.size() == v2.votes.size();
+    return v1.stroke == v2.stroke && v1.totalVotes == v2.totalVotes;
 }
 
-static const TextBox* findEnclosingTextBox(const Stroke& stroke, const vector<TextBox>& ocr) {
+void addVote(VotedStroke& stroke, VoteType type, const TextBox* label) {
+    ++stroke.votes[type];
+    if (stroke.totalVotes++ == 0 || stroke.votes[type] > stroke.votes[stroke.best]) {
+        stroke.best = type;
+    }
+    if (label != nullptr && stroke.label == nullptr) {
+        stroke.label = label;
+    }
+}
+
+// Text boxes sorted by each of their edges, so that the boxes a stroke
+// could be associated with are found without clipping it against all of
+// them. Queries return candidates in `ocr` order; callers still apply the
+// exact tests to them.
+class TextBoxIndex {
+public:
+    TextBoxIndex(const vector<TextBox>& ocr) : maxWidth(0) {
+        for (size_t i = 0; i < ocr.size(); ++i) {
+            const Rect& r = ocr[i].boundary;
+            byLeft.push_back(make_pair(r.x, i));
+            byRight.push_back(make_pair(r.x + r.width, i));
+            byTop.push_back(make_pair(r.y, i));
+            byBottom.push_back(make_pair(r.y + r.height, i));
+            boxes.push_back(r);
+            maxWidth = max(maxWidth, r.width);
+        }
+        sort(byLeft.begin(), byLeft.end());
+        sort(byRight.begin(), byRight.end());
+        sort(byTop.begin(), byTop.end());
+        sort(byBottom.begin(), byBottom.end());
+    }
+
+    // boxes whose closed extent meets [x0, x1] x [y0, y1]
+    vector<size_t> meeting(int x0, int y0, int x1, int y1) const {
+        vector<size_t> result;
+        auto it = lower_bound(byLeft.begin(), byLeft.end(), make_pair(x0 - maxWidth, (size_t)0));
+        for (; it != byLeft.end() && it->first <= x1; ++it) {
+            const Rect& r = boxes[it->second];
+            if (r.x + r.width >= x0 && r.y <= y1 && r.y + r.height >= y0) {
+                result.push_back(it->second);
+            }
+        }
+        sort(result.begin(), result.end());
+        return result;
+    }
+
+    // boxes with a left or right edge less than `reach` from x
+    vector<size_t> verticalEdgesNear(int x, int reach) const {
+        return edgesNear(byLeft, byRight, x, reach);
+    }
+
+    // boxes with a top or bottom edge less than `reach` from y
+    vector<size_t> horizontalEdgesNear(int y, int reach) const {
+        return edgesNear(byTop, byBottom, y, reach);
+    }
+
+private:
+    typedef vector<pair<int, size_t>> Edges;
+
+    static vector<size_t> edgesNear(const Edges& e1, const Edges& e2, int v, int reach) {
+        vector<size_t> result;
+        for (auto* edges : { &e1, &e2 }) {
+            auto it = lower_bound(edges->begin(), edges->end(), make_pair(v - reach + 1, (size_t)0));
+            for (; it != edges->end() && it->first < v + reach; ++it) {
+                result.push_back(it->second);
+            }
+        }
+        sort(result.begin(), result.end());
+        result.erase(unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    vector<Rect> boxes;
+    Edges byLeft, byRight, byTop, byBottom;
+    int maxWidth;
+};
+
+static const TextBox* findEnclosingTextBox(const Stroke& stroke, const vector<TextBox>& ocr, const TextBoxIndex& index) {
     double len = segmentLength(stroke.line);
-    for (auto& box : ocr) {
+
+    // segmentOverlapWithRect can only be nonempty for boxes that meet the
+    // stroke's rows, and whose columns come within the stroke's width of
+    // its own (clipping at the top mirrors the cut end horizontally)
+    const Vec4i& l = stroke.line;
+    int xmin = min(l[0], l[2]), xmax = max(l[0], l[2]);
+    int w = xmax - xmin + 1;
+    for (size_t i : index.meeting(xmin - w, min(l[1], l[3]), xmax + w, max(l[1], l[3]))) {
+        auto& box = ocr[i];
         if (segmentLength(segmentOverlapWithRect(stroke.line, box.boundary)) > 0.85 * len) {
             return &box;
         }
@@ -30,7 +117,7 @@ static bool couldBeMeasurementText(const Vec4i& line, const TextBox& text) {
     }
 
     // pretty close
-    const int thresh = 100;
+    const int thresh = MEASUREMENT_TEXT_REACH;
     if (mostlyVertical(line)) {
         return min(abs(line[0] - text.boundary.x), abs(line[0] - (text.boundary.x + text.boundary.width))) < thresh;
     } else if (mostlyHorizontal(line)) {
@@ -39,9 +126,16 @@ static bool couldBeMeasurementText(const Vec4i& line, const TextBox& text) {
     return false;
 }
 
-static vector<const TextBox*> findMeasurementTextBoxes(const Stroke& stroke, const vector<TextBox>& ocr) {
+static vector<const TextBox*> findMeasurementTextBoxes(const Stroke& stroke, const vector<TextBox>& ocr, const TextBoxIndex& index) {
+    // only boxes with an edge in reach can pass couldBeMeasurementText
+    const Vec4i& l = stroke.line;
+    vector<size_t> candidates = mostlyVertical(l) ?
+        index.verticalEdgesNear(l[0], MEASUREMENT_TEXT_REACH) :
+        index.horizontalEdgesNear(l[1], MEASUREMENT_TEXT_REACH);
+
     vector<const TextBox*> result;
-    for (auto& box : ocr) {
+    for (size_t i : candidates) {
+        auto& box = ocr[i];
         if (couldBeMeasurementText(stroke.line, box)) {
             // TODO: find top object and bottom object
             result.push_back(&box);
@@ -56,40 +150,90 @@ static void orientLR(VotedStroke& stroke) {
     stroke.stroke.line = orientLR(stroke.stroke.line);
 }
 
-static VotedStroke* findLeftStroke(VotedStroke& stroke, vector<VotedStroke>& strokes) {
-    orientLR(stroke);
-    int bestScore = -1;
-    double len = segmentLength(stroke.stroke.line);
-    VotedStroke* best = nullptr;
-    for (auto& s : strokes) {
-        int score = min(distance(p1(stroke.stroke.line), p1(s.stroke.line)),
-                        distance(p1(stroke.stroke.line), p2(s.stroke.line)));
-        if (mostlyVertical(s.stroke.line) &&
-                score < CORNER_THRESH * len &&
-                (bestScore < 0 || score < bestScore)) {
-            bestScore = score;
-            best = &s;
+static int cornerScore(const Vec2i& corner, const Vec4i& line) {
+    return min(distance(corner, p1(line)), distance(corner, p2(line)));
+}
+
+// A grid over the endpoints of the mostly-vertical strokes, which is where
+// the sides of a box can meet its top or bottom. Those strokes are never
+// reoriented while votes are placed, so the grid stays valid throughout.
+class EndpointGrid {
+public:
+    EndpointGrid(const vector<VotedStroke>& strokes, int cellSize) : strokes(strokes), cellSize(cellSize) {
+        for (size_t i = 0; i < strokes.size(); ++i) {
+            const Vec4i& l = strokes[i].stroke.line;
+            if (mostlyVertical(l)) {
+                cells.push_back(make_pair(cellOf(l[0], l[1]), i));
+                if (cellOf(l[2], l[3]) != cellOf(l[0], l[1])) {
+                    cells.push_back(make_pair(cellOf(l[2], l[3]), i));
+                }
+            }
         }
+        sort(cells.begin(), cells.end());
     }
-    return best;
-}
 
-static VotedStroke* findRightStroke(VotedStroke& stroke, vector<VotedStroke>& strokes) {
-    orientLR(stroke);
-    int bestScore = -1;
-    double len = segmentLength(stroke.stroke.line);
-    VotedStroke* best = nullptr;
+    // The index of the vertical stroke with an endpoint nearest `corner`
+    // (with distances truncated to ints, and ties going to the earliest
+    // stroke) if that distance is under `reach`, or -1.
+    int nearest(const Vec2i& corner, double reach) const {
+        // truncated distances under `reach` are under ceil(reach)
+        int r = ceil(reach);
+        int cx0 = floorDiv(corner[0] - r), cx1 = floorDiv(corner[0] + r);
+        int cy0 = floorDiv(corner[1] - r), cy1 = floorDiv(corner[1] + r);
+        int bestScore = -1;
+        int best = -1;
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            auto it = lower_bound(cells.begin(), cells.end(), make_pair(make_pair(cy, cx0), (size_t)0));
+            for (; it != cells.end() && it->first.first == cy && it->first.second <= cx1; ++it) {
+                int i = it->second;
+                int score = cornerScore(corner, strokes[i].stroke.line);
+                if (score < reach && (bestScore < 0 || score < bestScore || (score == bestScore && i < best))) {
+                    bestScore = score;
+                    best = i;
+                }
+            }
+        }
+        return best;
+    }
+
+private:
+    int floorDiv(int x) const {
+        return x >= 0 ? x / cellSize : -((-x + cellSize - 1) / cellSize);
+    }
+
+    pair<int, int> cellOf(int x, int y) const {
+        return make_pair(floorDiv(y), floorDiv(x));
+    }
+
+    const vector<VotedStroke>& strokes;
+    const int cellSize;
+    vector<pair<pair<int, int>, size_t>> cells; // sorted by cell (row, column)
+};
+
+// Cells are about as big as a typical corner search, so most searches
+// look at a handful of cells.
+static int cornerCellSize(const vector<VotedStroke>& strokes) {
+    vector<double> reaches;
     for (auto& s : strokes) {
-        int score = min(distance(p2(stroke.stroke.line), p1(s.stroke.line)),
-                        distance(p2(stroke.stroke.line), p2(s.stroke.line)));
-        if (mostlyVertical(s.stroke.line) &&
-                score < CORNER_THRESH * len &&
-                (bestScore < 0 || score < bestScore)) {
-            bestScore = score;
-            best = &s;
+        if (mostlyHorizontal(s.stroke.line)) {
+            reaches.push_back(CORNER_THRESH * segmentLength(s.stroke.line));
         }
     }
-    return best;
+    if (reaches.empty()) {
+        return 1;
+    }
+    nth_element(reaches.begin(), reaches.begin() + reaches.size() / 2, reaches.end());
+    return max(1, (int)ceil(reaches[reaches.size() / 2]));
+}
+
+static VotedStroke* findLeftStroke(const VotedStroke& stroke, vector<VotedStroke>& strokes, const EndpointGrid& grid) {
+    int i = grid.nearest(p1(stroke.stroke.line), CORNER_THRESH * segmentLength(stroke.stroke.line));
+    return i < 0 ? nullptr : &strokes[i];
+}
+
+static VotedStroke* findRightStroke(const VotedStroke& stroke, vector<VotedStroke>& strokes, const EndpointGrid& grid) {
+    int i = grid.nearest(p2(stroke.stroke.line), CORNER_THRESH * segmentLength(stroke.stroke.line));
+    return i < 0 ? nullptr : &strokes[i];
 }
 
 vector<VotedStroke> placeVotes(
@@ -98,39 +242,43 @@ vector<VotedStroke> placeVotes(
 
     vector<VotedStroke> v;
     for (auto& stroke : strokes) {
-        v.push_back(VotedStroke { stroke, vector<Vote>() });
+        v.push_back(VotedStroke { stroke, { }, 0, BOX_TOP, nullptr });
     }
 
+    const EndpointGrid corners(v, cornerCellSize(v));
+    const TextBoxIndex text(ocr);
+
     for (auto& stroke : v) {
-        const TextBox* text = findEnclosingTextBox(stroke.stroke, ocr);
-        if (text != nullptr) {
-            stroke.votes.push_back({ TEXT, *text });
+        const TextBox* enclosing = findEnclosingTextBox(stroke.stroke, ocr, text);
+        if (enclosing != nullptr) {
+            addVote(stroke, TEXT, enclosing);
         }
 
         if (mostlyHorizontal(stroke.stroke.line)) {
-            VotedStroke* leftSide = findLeftStroke(stroke, v);
-            VotedStroke* rightSide = findRightStroke(stroke, v);
+            orientLR(stroke);
+            VotedStroke* leftSide = findLeftStroke(stroke, v, corners);
+            VotedStroke* rightSide = findRightStroke(stroke, v, corners);
             bool isTop = false;
             if (leftSide != nullptr) {
-                leftSide->votes.push_back({ BOX_LEFT });
+                addVote(*leftSide, BOX_LEFT);
                 int idx = abs(leftSide->stroke.line[1] - stroke.stroke.line[1]) > abs(leftSide->stroke.line[3] - stroke.stroke.line[1]) ? 1 : 3;
                 isTop = leftSide->stroke.line[idx] > stroke.stroke.line[1];
             }
             if (rightSide != nullptr) {
-                rightSide->votes.push_back({ BOX_RIGHT });
+                addVote(*rightSide, BOX_RIGHT);
                 int idx = abs(rightSide->stroke.line[1] - stroke.stroke.line[1]) > abs(rightSide->stroke.line[3] - stroke.stroke.line[1]) ? 1 : 3;
                 isTop = rightSide->stroke.line[idx] > stroke.stroke.line[1];
             }
             if (leftSide != nullptr || rightSide != nullptr) {
-                stroke.votes.push_back({ isTop ? BOX_TOP : BOX_BOTTOM });
+                addVote(stroke, isTop ? BOX_TOP : BOX_BOTTOM);
             }
         } else if (mostlyVertical(stroke.stroke.line)) {
-            // stroke.votes.push_back({ BOX_LEFT });
+            // addVote(stroke, BOX_LEFT);
         }
 
-        for (auto* ptr : findMeasurementTextBoxes(stroke.stroke, ocr)) {
+        for (auto* ptr : findMeasurementTextBoxes(stroke.stroke, ocr, text)) {
             if (ptr != nullptr) {
-                stroke.votes.push_back({ MEASUREMENT_LINE, *ptr });
+                addVote(stroke, MEASUREMENT_LINE, ptr);
             }
         }
     }
@@ -138,35 +286,17 @@ vector<VotedStroke> placeVotes(
     return v;
 }
 
-static VoteType toType(const Vote& v) {
-    return v.type;
-}
-
-const Vote* bestVote(const VotedStroke& stroke) {
-    if (stroke.votes.size() == 0) {
-        return nullptr;
-    }
-
-    vector<VoteType> types(stroke.votes.size());
-    std::transform(stroke.votes.begin(), stroke.votes.end(), types.begin(), toType);
-    VoteType bestType = mode(types.begin(), types.end());
-
-    for (auto& v : stroke.votes) {
-        if (v.type == bestType) {
-            return &v;
-        }
-    }
-    return nullptr;
+VoteType bestVote(const VotedStroke& stroke) {
+    return stroke.best;
 }
 
 Mat displayVotes(const Mat& bg, const vector<VotedStroke>& votes) {
     Mat display;
     cvtColor(bg, display, CV_GRAY2BGR);
     for (auto& stroke : votes) {
-        const Vote* v = bestVote(stroke);
-        if (v != nullptr) {
+        if (stroke.totalVotes > 0) {
             Scalar color(100, 100, 100);
-            switch (v->type) {
+            switch (bestVote(stroke)) {
                 case BOX_TOP:          color = Scalar(255, 0,   0);   break;
                 case BOX_LEFT:         color = Scalar(0,   255, 0);   break;
                 case BOX_RIGHT:        color = Scalar(0,   0,   255); break;
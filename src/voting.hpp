@@ -11,23 +11,32 @@ enum VoteType {
     BOX_TOP, BOX_LEFT, BOX_RIGHT, BOX_BOTTOM, MEASUREMENT_LINE, TEXT
 };
 
-struct Vote {
-    VoteType type;
-    TextBox label; // when type == MEASUREMENT_LINE or TEXT
-};
-
+static const int VOTE_TYPES = TEXT + 1;
+
+/**
+ * A stroke and the votes cast for what it is. Only the number of votes of
+ * each type is kept, along with the text of the first TEXT or
+ * MEASUREMENT_LINE vote, which points into the OCR results the votes were
+ * placed with.
+ */
 struct VotedStroke {
     Stroke stroke;
-    std::vector<Vote> votes;
+    int votes[VOTE_TYPES];
+    int totalVotes;
+    VoteType best;         // the first type to reach the most votes
+    const TextBox* label;  // or null
 };
 
 bool operator==(const VotedStroke& v1, const VotedStroke& v2);
 
+void addVote(VotedStroke& stroke, VoteType type, const TextBox* label = nullptr);
+
 std::vector<VotedStroke> placeVotes(
     const std::vector<Stroke>& strokes,
     const std::vector<TextBox>& ocr);
 
-const Vote* bestVote(const VotedStroke& stroke);
+/** the type with the most votes; only meaningful if stroke.totalVotes > 0 */
+VoteType bestVote(const VotedStroke& stroke);
 
 cv::Mat displayVotes(const cv::Mat& bg, const std::vector<VotedStroke>& votes);
 